@@ -28,6 +28,8 @@
 
 #include <memory>
 
+#include <EspyTemplate.h>
+
 // fix crash on ESP32 (see https://github.com/alanswx/ESPAsyncWiFiManager/issues/44)
 #if defined(ESP8266)
 typedef int8_t wifi_ssid_count_t;
@@ -55,18 +57,62 @@ const char HTTP_FORM_END[] PROGMEM = R"(<br/><button type='submit'>save</button>
 const char HTTP_SCAN_LINK[] PROGMEM = R"(<br/><div class="c"><a href="/wifi">Scan</a></div>)";
 const char HTTP_SAVED[] PROGMEM = R"(<div>Credentials Saved<br />Trying to connect ESP to network.<br />If it fails reconnect to AP to try again</div>)";
 const char HTTP_END[] PROGMEM = R"(</div></body></html>)";
+const char HTTP_HEAD_CUSTOM[] PROGMEM = R"({h})";
+const char HTTP_PORTAL_TITLE[] PROGMEM = R"(<h1>{a}</h1>)";
+const char HTTP_OPTIONS_CUSTOM[] PROGMEM = R"({o})";
+const char HTTP_SCAN_REFRESH[] PROGMEM = R"(<meta http-equiv="refresh" content="3; url=/0wifi">)";
+const char HTTP_SCANNING[] PROGMEM = R"(Scanning...)";
+const char HTTP_NO_NETWORKS[] PROGMEM = R"(No networks found. Refresh to scan again.)";
+const char HTTP_ITEMS_END[] PROGMEM = R"(<br/>)";
+const char HTTP_FORM_CUSTOM[] PROGMEM = R"({c})";
+const char HTTP_FORM_PARAMS_END[] PROGMEM = R"(<br/>)";
+const char HTTP_INFO_REFRESH[] PROGMEM = R"(<meta http-equiv="refresh" content="5; url=/i">)";
+const char HTTP_INFO_START[] PROGMEM = R"(<dl>)";
+const char HTTP_INFO_CONNECTING[] PROGMEM = R"(<dt>Trying to connect</dt><dd>{s}</dd>)";
+const char HTTP_INFO[] PROGMEM = R"(<dt>Chip ID</dt><dd>{c}</dd><dt>Flash Chip ID</dt><dd>{f}</dd><dt>IDE Flash Size</dt><dd>{z} bytes</dd><dt>Real Flash Size</dt><dd>{r} bytes</dd><dt>Soft AP IP</dt><dd>{a}</dd><dt>Soft AP MAC</dt><dd>{m}</dd><dt>Station SSID</dt><dd>{s}</dd><dt>Station IP</dt><dd>{i}</dd><dt>Station MAC</dt><dd>{n}</dd></dl>)";
+const char HTTP_RESET[] PROGMEM = R"(Module will reset in a few seconds.)";
 
 // maximum number of parameters for the portal
 const uint8_t WIFI_MANAGER_MAX_CUSTOM_CONFIG_PARAMETERS = 10;
 
-// maximum number of loop retries for the regular connection task
+// a connection attempt without a result fails after this
 #define WIFI_MANAGER_MAX_RETRY_TIME_MS 30000
+// initial connect task period. The task reschedules itself from the connect state.
 #define WIFI_MANAGER_CONNECTION_TASK_TIME_MS 1000
 
+// wait between failed attempts, doubles per failure. The actual wait is
+// a random time between half and all of it, so devices that lost the
+// access point at the same time do not retry in lockstep.
+#define WIFI_MANAGER_BACKOFF_MIN_MS 1000
+#define WIFI_MANAGER_BACKOFF_MAX_MS 120000ul
+
+// link quality check period while connected, events wake the task up earlier
+#define WIFI_MANAGER_CONNECTED_TASK_TIME_MS 10000
+
+// poll period while the connect task waits for a scan
+#define WIFI_MANAGER_CONNECT_SCAN_WAIT_MS 250
+
+// the link is degraded when the RSSI stays below this for WIFI_MANAGER_ROAM_SAMPLES checks
+#define WIFI_MANAGER_ROAM_RSSI (-75)
+#define WIFI_MANAGER_ROAM_SAMPLES 3
+// a saved access point must be this much stronger than the current one to roam
+#define WIFI_MANAGER_ROAM_HYSTERESIS_DB 10
+// no roaming for this long after connecting, or after a roam scan found nothing better
+#define WIFI_MANAGER_ROAM_HOLDOFF_MS 300000ul
+
 // maximum number of loop retries for the configuration task
 #define WIFI_MANAGER_MAX_CONFIG_RETRY_TIME_MS 30000
 #define WIFI_MANAGER_CONFIG_MENU_TASK_TIME_MS 100
 
+// time for a join with the cached BSSID and channel before falling back to a full scan
+#define WIFI_MANAGER_FAST_CONNECT_TIMEOUT_MS 3000
+
+// scan results younger than this are served without scanning again
+#define WIFI_MANAGER_SCAN_TTL_MS 30000
+
+// highest 2.4 GHz channel a scan can be limited to, 0 scans all
+#define WIFI_MANAGER_MAX_CHANNEL 14
+
 class CustomWiFiManagerParameter {
 public:
     CustomWiFiManagerParameter(const char *id, const char *placeholder, const char *defaultValue, int length, const char *custom = "");
@@ -92,31 +138,134 @@ private:
 };
 
 
+// unique networks kept from one scan, strongest first
+#define WIFI_MANAGER_MAX_SCAN_RESULTS 48
+// bytes for the SSIDs of one scan (NUL terminated)
+#define WIFI_MANAGER_SCAN_SSID_POOL 768
+// SDK results looked at per scan
+#define WIFI_MANAGER_MAX_SCAN_RAW 128
+// dedupe hash table, power of two and larger than WIFI_MANAGER_MAX_SCAN_RESULTS
+#define WIFI_MANAGER_SCAN_HASH_SIZE 128
+
 class WiFiResult {
 public:
-    bool duplicate;
-    String SSID;
+    uint16_t ssidOffset;    // in WiFiScanSet::ssids
     uint8_t encryptionType;
-    int32_t RSSI;
-    uint8_t *BSSID;
-    int32_t channel;
+    int8_t RSSI;
+    uint8_t channel;
+    uint8_t BSSID[6];
     bool isHidden;
+};
+
+/*
+ * One scan. Fixed size, so a scan never touches the heap.
+ */
+class WiFiScanSet {
+public:
+    uint8_t count = 0;
+    WiFiResult networks[WIFI_MANAGER_MAX_SCAN_RESULTS];
+    char ssids[WIFI_MANAGER_SCAN_SSID_POOL];
+
+    const char *ssid(uint8_t i) const {
+        return ssids + networks[i].ssidOffset;
+    }
+};
+
+// saved networks, most recently connected first
+#define WIFI_MANAGER_MAX_CREDENTIALS 4
+// bump when the store layout changes, old stores are ignored
+#define WIFI_MANAGER_CREDENTIALS_MAGIC 0x45535701u
+// EEPROM offset of the store, behind the boot record
+#define WIFI_MANAGER_CREDENTIALS_EEPROM_OFFSET 64
 
-    WiFiResult() {
+class WiFiCredential {
+public:
+    char ssid[33];
+    char password[65];
+};
+
+class WiFiCredentialStore {
+public:
+    uint32_t magic;
+    uint32_t checksum;
+    uint8_t count;
+    uint8_t reserved[3];
+    WiFiCredential networks[WIFI_MANAGER_MAX_CREDENTIALS];
+};
+
+enum wifi_connect_state {
+    WIFI_STATE_START,       // connect at the next task run
+    WIFI_STATE_CONNECTING,
+    WIFI_STATE_CONNECTED,
+    WIFI_STATE_BACKOFF      // wait before the next attempt
+};
+
+/*
+ * Values for the portal page templates.
+ */
+// a network as shown on the wifi page
+class WiFiPageNetwork {
+public:
+    uint16_t ssidOffset;    // in CustomWiFiManagerPage::ssids
+    uint8_t quality;
+    bool locked;
+};
+
+class CustomWiFiManagerPage : public EspyTemplate {
+public:
+    const char *title = "";
+    const char *head = "";
+    const char *options = "";
+    const char *apName = "";
+
+    // wifi page. The shown networks are copied, a scan completing while
+    // the page is sent may refill the set they came from.
+    std::unique_ptr<WiFiPageNetwork[]> networkList;
+    std::unique_ptr<char[]> ssids;
+    uint8_t networks = 0;
+    bool scanFound = false;         // the scan found networks, shown or not
+    bool scanPending = false;
+    CustomWiFiManagerParameter *const *params = nullptr;
+    uint8_t paramCount = 0;
+
+    // info and save pages
+    bool refresh = false;
+    bool connecting = false;
+    wl_status_t status = WL_NO_SHIELD;
+
+    CustomWiFiManagerPage(PGM_P const *parts, uint8_t count)
+            : EspyTemplate(parts, count) {
     }
 
+    // copy the first count networks of set
+    void setNetworks(const WiFiScanSet &set, uint8_t count);
+
+protected:
+    uint8_t repeat(PGM_P part) override;
+
+    PGM_P text(PGM_P part, uint8_t item) override;
+
+    const char *value(PGM_P part, uint8_t item, char key) override;
+
+private:
+    const char *infoValue(char key);
 };
 
 class CustomWiFiManager {
 public:
-    // visible for menu reporting
+    // visible for menu reporting. Failed attempts since the last connection.
     unsigned int connectionRetries = 0;
 
     explicit CustomWiFiManager(AsyncWebServer *server);
 
     // connect task. Drive from task scheduler in normal operation to ensure wifi
-    // connection.
-    void connectTask();
+    // connection. Returns the time in ms until it wants to run again.
+    uint32_t connectTask();
+
+    wifi_connect_state connectState() const;
+
+    // called from the wifi event handlers, so the connect task can be run right away
+    void setConnectEventCallback(void (*func)());
 
     // config portal task. Drive from task scheduler in portal operation.
     // returns true if connection was successful.
@@ -125,14 +274,56 @@ public:
     // config portal mode
     void enableConfigPortal(char const *apName, char const *apPassword = nullptr);
 
-    // scan task to look for new networks. Must be driven from task scheduler during
-    // portal mode to look for new wifi networks
-    void scanNetworkTask();
+    // leave config portal mode, the connect task takes over
+    void disableConfigPortal();
+
+    // scan task. Starts a requested scan and publishes the results when it
+    // completes, never blocks. Returns false when there is nothing left to do.
+    bool scanNetworkTask();
+
+    // true while a scan is running
+    bool scanRunning() const;
+
+    // true while a scan is running or requested
+    bool scanPending() const;
+
+    // drop a running or requested scan. The scan task must stop polling
+    // afterwards, nothing else picks up the results.
+    void cancelScan();
+
+    // ask for a scan, limited to an SSID (finds hidden networks) and/or a
+    // channel if given. Does nothing if the cached results for the same
+    // limits are younger than the TTL. While a scan with other limits
+    // runs, the request waits behind it. Returns true if a scan is pending.
+    bool requestScan(const char *ssid = nullptr, uint8_t channel = 0);
+
+    // age limit for cached scan results
+    void setScanTTL(uint32_t ms);
+
+    // called when a scan was requested, so the scan task can be started
+    void setScanRequestCallback(void (*func)());
+
+    // called with the number of networks found (or a negative error) when a scan completes
+    void setScanCompleteCallback(void (*func)(int));
+
+    // stop the station for the config portal. The saved networks and the
+    // cached access point stay.
+    void disconnect();
 
     //
-    // clear wifi settings (also from eeprom)
+    // clear wifi settings (also from eeprom): saved networks and the cached access point
     void resetSettings();
 
+    // save a network, or move it to the front if it is already saved.
+    // The least recently connected network is dropped when the store is full.
+    void addCredential(const char *ssid, const char *password);
+
+    // number of saved networks
+    uint8_t credentialCount() const;
+
+
+    // use a static IP configuration instead of DHCP
+    void setStaticIP(IPAddress ip, IPAddress gateway, IPAddress mask, IPAddress dns);
 
     //defaults to not showing anything under 8% signal quality if called
     void setMinimumSignalQuality(int quality = 8);
@@ -149,10 +340,12 @@ public:
     //sets a custom element to add to options page
     void setCustomOptionsElement(const char *element);
 
+    // signal quality in percent
+    static int getRSSIasQuality(int RSSI);
+
 private:
     AsyncWebServer *_server;
 
-    String _cache_infoPage = "";
     wl_status_t _cache_wifiStatus = WL_NO_SHIELD;
 
     const char *_config_portal_ap_name = "no-net";
@@ -171,16 +364,101 @@ private:
     const char *_config_custom_html_head = "";
     const char *_config_custom_html_options = "";
 
-    wifi_ssid_count_t _config_portal_last_wifi_scan_count = 0;
-    WiFiResult *_config_portal_last_wifi_scan_networks = nullptr;
+    // double buffered scan results. Readers use the published set, a scan
+    // fills the other one and then flips the index.
+    WiFiScanSet _scan_sets[2];
+    volatile uint8_t _scan_published = 0;
 
     void (*_config_portal_save_settings_callback)() = nullptr;
 
+    bool _scan_running = false;
+    bool _scan_requested = false;
+    uint32_t _scan_ttl_ms = WIFI_MANAGER_SCAN_TTL_MS;
+    void (*_scan_request_callback)() = nullptr;
+
+    // limits of the requested scan, of the running one and of the published results
+    char _scan_ssid[33] = "";
+    uint8_t _scan_channel = 0;
+    char _scan_running_ssid[33] = "";
+    uint8_t _scan_running_channel = 0;
+    char _scan_published_ssid[33] = "";
+    uint8_t _scan_published_channel = 0;
+    uint32_t _scan_published_at = 0;
+    bool _scan_valid = false;
+    // the station was connecting and got stopped for the scan
+    bool _scan_reconnect = false;
+    void (*_scan_complete_callback)(int) = nullptr;
+
+    // static IP configuration, ip is 0 for DHCP
+    IPAddress _static_ip;
+    IPAddress _static_gateway;
+    IPAddress _static_mask;
+    IPAddress _static_dns;
+
+    wifi_connect_state _connect_state = WIFI_STATE_START;
+    uint32_t _connect_state_since = 0;
+    uint32_t _connect_backoff_ms = 0;
+
+    // set by the event handlers, handled by the connect task
+    volatile bool _event_got_ip = false;
+    volatile bool _event_disconnected = false;
+    WiFiEventHandler _got_ip_handler;
+    WiFiEventHandler _disconnected_handler;
+    void (*_connect_event_callback)() = nullptr;
+
+    // saved networks
+    WiFiCredentialStore _credentials{};
+    // the connect task asked for a scan to pick a network
+    bool _connect_scan_requested = false;
+    // link checks in a row below WIFI_MANAGER_ROAM_RSSI
+    uint8_t _roam_weak_samples = 0;
+
+    bool _fast_connecting = false;      // joining with the cached BSSID and channel
+    bool _fast_connect_failed = false;  // the cached values did not work, use a full scan
+    bool _connection_saved = false;
+
     bool connectWifi(const String *ssid = nullptr, const String *pass = nullptr);
 
+    void setConnectState(wifi_connect_state state);
+
+    // give up on the current attempt and wait before the next one
+    void connectFailed();
+
+    // join the strongest saved network of a current scan, or cycle
+    // through the saved networks if none was seen
+    void beginSavedNetwork();
+
+    // strongest network in the scan that is saved, at least min_rssi strong,
+    // above the minimum quality and not the given BSSID. Returns the index
+    // in the scan set or -1, and the saved network in credential.
+    int bestNetwork(const WiFiScanSet &set, int min_rssi, const uint8_t *exclude_bssid, uint8_t *credential) const;
+
+    // above the minimum quality, the same test for the list and for connecting
+    bool qualityOk(int RSSI) const;
+
+    // link quality check while connected, roams to a clearly better
+    // access point if the link stays degraded. Returns the time until the next check.
+    uint32_t roamTask();
+
+    // true if the published scan is younger than the TTL and was limited as given
+    bool scanCached(const char *ssid, uint8_t channel) const;
+
+    void loadCredentials();
+
+    void storeCredentials();
+
+    // join the cached access point directly, false if nothing is cached
+    bool fastConnect();
+
+    // static IP or DHCP
+    void configureIP();
+
+    // cache BSSID and channel of the current connection
+    void saveConnection();
+
     static void disableWifi();
 
-    void scan();
+    void scanDone(int n);
 
     void updateInfo();
 
@@ -200,13 +478,13 @@ private:
 
     static boolean captivePortal(AsyncWebServerRequest *);
 
-    static String infoAsHtml();
+    // a portal page with the custom head filled in
+    std::shared_ptr<CustomWiFiManagerPage> portalPage(PGM_P const *parts, uint8_t count, const char *title);
 
     //helpers
 
-    String networkListAsString();
-
-    static int getRSSIasQuality(int RSSI);
+    // the last published scan
+    const WiFiScanSet &scanResults() const;
 
     static boolean isIp(const String &str);
 
@@ -0,0 +1,50 @@
+/* -*- mode: C++; -*-
+ *
+ * Static arena for the objects that live as long as the program.
+ */
+
+#include <Arduino.h>
+#include <new>
+#include <utility>
+
+#ifndef _ESPY_ESPYARENA_H_
+#define _ESPY_ESPYARENA_H_
+
+// bytes reserved for boot time objects. Check the high water mark
+// (System > Memory) after adding objects.
+#define BOOT_ARENA_SIZE 5120
+
+/*
+ * Bump allocator over a static buffer. Nothing is ever freed, so the heap
+ * stays free for the short lived allocations of the web portal.
+ *
+ * Has no constructor: it is zero initialized before any static constructor
+ * runs, so global objects may allocate from it.
+ */
+class EspyArena {
+public:
+    // size bytes from the arena, or from the heap if the arena is full
+    void *allocate(size_t size, size_t align);
+
+    // construct a T in the arena
+    template<typename T, typename... Args>
+    T *make(Args &&... args) {
+        return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // bytes handed out from the arena (the high water mark, nothing is freed)
+    size_t used() const;
+
+    // bytes that did not fit and went to the heap
+    size_t overflow() const;
+
+    static size_t capacity();
+
+private:
+    alignas(8) uint8_t pool[BOOT_ARENA_SIZE];
+    size_t _used;
+    size_t _overflow;
+};
+
+
+#endif //_ESPY_ESPYARENA_H_
@@ -8,18 +8,22 @@
 
 #include <espy.h>
 
+/*
+ * Blink phase derived from the clock, so it stays correct
+ * no matter how often (or late) it is looked at.
+ */
 class EspyBlinker {
  public:
-  explicit EspyBlinker(int initial_in_ticks);
-
-  void blink();
+  explicit EspyBlinker(uint32_t half_period_in_ms);
 
-  bool state;
+  // blink state at the given time
+  bool state(uint32_t now) const;
 
+  // time of the next state change after now
+  uint32_t next_edge(uint32_t now) const;
 
  private:
-    int initial;
-    int counter;
+    uint32_t half_period;
 };
 
 
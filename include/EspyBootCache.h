@@ -0,0 +1,62 @@
+/* -*- mode: C++; -*-
+ *
+ * Boot time state that survives a reset.
+ */
+
+#include <Arduino.h>
+
+#ifndef _ESPY_ESPYBOOTCACHE_H_
+#define _ESPY_ESPYBOOTCACHE_H_
+
+#include <espy.h>
+
+// bump when the record layout changes, old records are ignored
+#define BOOT_CACHE_MAGIC 0x45535903u
+
+// RTC user memory block (4 bytes each) and EEPROM offset of the record.
+// Blocks 0-31 belong to the OTA boot loader command.
+#define BOOT_CACHE_RTC_BLOCK 64
+#define BOOT_CACHE_EEPROM_OFFSET 0
+
+// size of the emulated EEPROM. Every EEPROM.begin() must use it: commit()
+// erases the whole flash sector and writes back only the bytes begun with.
+#define ESPY_EEPROM_SIZE 512
+
+/*
+ * Everything found at the last boot. The size must be a multiple of 4
+ * (RTC memory is accessed in 32 bit blocks).
+ */
+struct boot_record {
+    uint32_t magic;
+    uint32_t checksum;
+    uint8_t pcf_address;
+    uint8_t display_address;
+    // last successful wifi connection, channel 0 if none
+    uint8_t wifi_channel;
+    uint8_t wifi_bssid[6];
+    uint8_t reserved[3];
+};
+
+/*
+ * Keeps the boot record in RTC memory (survives a reset, not a power cycle)
+ * and in flash (survives both, but writes wear the flash).
+ */
+class EspyBootCache {
+public:
+    boot_record record{};
+
+    // load the record from RTC memory, or flash if the RTC copy is invalid.
+    // returns false (and clears the record) if neither copy is valid.
+    bool load();
+
+    // save the record to RTC memory, and to flash if the flash copy differs
+    void store();
+
+private:
+    static uint32_t checksum(const boot_record &r);
+
+    static bool valid(const boot_record &r);
+};
+
+
+#endif //_ESPY_ESPYBOOTCACHE_H_
@@ -0,0 +1,43 @@
+/* -*- mode: C++; -*-
+ *
+ * Bit parallel debouncer for the port expander inputs.
+ */
+
+#include <Arduino.h>
+
+#ifndef _ESPY_ESPYDEBOUNCER_H_
+#define _ESPY_ESPYDEBOUNCER_H_
+
+// bit planes of the vertical counter. Debounce thresholds are 1 .. 15 ticks.
+#define DEBOUNCE_PLANES 4
+#define DEBOUNCE_MAX_TICKS ((1u << DEBOUNCE_PLANES) - 1)
+
+/*
+ * Debounces all eight bits of an input byte at once with a vertical
+ * counter: bit n of plane k is bit k of the tick counter for input n.
+ * Every input has its own threshold, also stored as bit planes.
+ */
+class EspyDebouncer {
+public:
+    explicit EspyDebouncer(uint8_t ticks);
+
+    // set the number of stable ticks needed for the inputs in mask to change
+    void set_threshold(uint8_t mask, uint8_t ticks);
+
+    // feed a raw sample, returns the bits that changed their debounced state
+    uint8_t update(uint8_t raw);
+
+    // debounced input state
+    uint8_t state() const;
+
+    // true while any input is counting towards a change
+    bool busy() const;
+
+private:
+    uint8_t debounced = 0;
+    uint8_t counter[DEBOUNCE_PLANES]{};
+    uint8_t threshold[DEBOUNCE_PLANES]{};
+};
+
+
+#endif //_ESPY_ESPYDEBOUNCER_H_
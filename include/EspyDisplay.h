@@ -18,15 +18,21 @@ enum led_state {
     FAST = 4
 };
 
-#define LED_TOGGLE(x, n) (x)->leds[n] = ((x)->leds[n] == led_state::ON) ? led_state::OFF : led_state::ON
+#define LED_TOGGLE(x, n) (x)->set_led(n, ((x)->leds[n] == led_state::ON) ? led_state::OFF : led_state::ON)
 
 extern const char *LED_state_names[];
 
 #define LED_STATE(x, n) LED_state_names[(int)((x)->leds[n])]
 
-#define REFRESH_RATE (1000 / 50)
-#define BLINK_SLOW (560 / REFRESH_RATE) // 2 second blink
-#define BLINK_FAST (100 / REFRESH_RATE)  // 0.5 second blink
+// blink half periods
+#define BLINK_SLOW_MS 560
+#define BLINK_FAST_MS 100
+
+// longest time the display task sleeps without a blink edge or commit
+#define DISPLAY_MAX_SLEEP_MS 1000
+
+// time per marquee scroll step
+#define MARQUEE_STEP_MS 350
 
 class EspyDisplay;
 
@@ -38,23 +44,52 @@ public:
     explicit EspyDisplayBuffer(const char *name);
 
     led_state leds[5] = {OFF, OFF, OFF, OFF, OFF};
+    // back buffer. Drawn into by the owner of the buffer, shown after commit()
     char text[DISPLAY_ROWS][DISPLAY_COLS + 1]{};
 
     const char *name();
 
+    // clear the back buffer
     void clear();
 
-    void lcd_print(int row, const char *fmt ...);
+    // change a led, wakes up the display if this buffer is shown
+    void set_led(int n, led_state state);
+
+    // replace a row of the back buffer with the given values, e.g.
+    // lcd_row(1, F("Retry: "), retries) or lcd_row(0, align_left(ssid, 14), glyph)
+    template<typename... Args>
+    void lcd_row(int row, const Args &... args) {
+        EspyRowWriter writer(text[row], DISPLAY_COLS);
+        espy_format(writer, args...);
+        writer.fill();
+        marquee[row][0] = '\0';
+    }
+
+    // show text in a row, scrolling it through the row if it is longer than the display.
+    // Text beyond LCD_MARQUEE_MAX is cut off.
+    void lcd_marquee(int row, const char *value);
 
-    void lcd_print_P(int row, const char *fmt ...);
+    // publish the back buffer as a complete frame and request a render
+    void commit();
 
-    void request_render();
+    // number of commits so far
+    uint32_t generation() const;
 
 private:
     const char *_name;
-    bool render = false;
+    char marquee[DISPLAY_ROWS][LCD_MARQUEE_MAX + 1]{};  // back buffer scrolling rows
+    uint32_t marquee_start = 0;
 
-    bool render_and_reset();
+    // front buffer, last committed frame
+    char frame[DISPLAY_ROWS][DISPLAY_COLS + 1]{};
+    char frame_marquee[DISPLAY_ROWS][LCD_MARQUEE_MAX + 1]{};
+    uint32_t frame_marquee_start = 0;
+    bool frame_scrolls = false;
+
+    uint32_t _generation = 0;
+    EspyDisplay *owner = nullptr;   // display showing this buffer
+
+    void wake();
 };
 
 /*
@@ -64,18 +99,44 @@ class EspyDisplay {
 public:
     EspyDisplayBuffer *current;     // Current display buffer. Will be rendered at refresh
 
-    explicit EspyDisplay(EspyHardware &_hardware);
+    // wakeup is called when the current buffer has a new frame or led state
+    explicit EspyDisplay(EspyHardware &_hardware, void (*_wakeup)() = nullptr);
 
-    void refresh();
+    // render the current buffer, returns the time in ms until the next deadline
+    uint32_t refresh();
 
     void display(EspyDisplayBuffer *buf);
 
+    void wake();
+
+    // render the current buffer again at the next refresh, even if it did not change
+    void redraw();
+
+    // character code for a glyph (see EspyGlyphCache), a plain character
+    // if there is no display
+    char glyph(uint8_t id);
+
+    char glyph(uint8_t id, const uint8_t *bitmap);
+
+    // fill width cells (and a terminator) with a bar graph of value / max
+    void bar(char *cells, uint8_t width, uint32_t value, uint32_t max);
+
 private:
     EspyHardware &hardware;         // Reference to the detected hardware
+    EspyDisplayBuffer *rendered = nullptr;  // buffer, generation and marquee step on the panel
+    uint32_t rendered_generation = 0;
+    uint32_t rendered_step = 0;
     EspyBlinker fast;
     EspyBlinker slow;
+    void (*wakeup)();
+
+    uint8_t compute_led_state(uint32_t now) const;
+
+    uint32_t next_deadline(uint32_t now) const;
+
+    uint32_t marquee_step(uint32_t now) const;
 
-    uint8_t compute_led_state() const;
+    uint8_t pinned_glyphs() const;
 };
 
 
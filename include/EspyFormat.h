@@ -0,0 +1,103 @@
+/* -*- mode: C++; -*-
+ *
+ * Typed, allocation free formatting for fixed width display rows.
+ */
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#ifndef _ESPY_ESPYFORMAT_H_
+#define _ESPY_ESPYFORMAT_H_
+
+#include <espy.h>
+
+/*
+ * A value printed into a field of fixed width, padded with spaces.
+ * Create with align_left / align_right.
+ */
+template<typename T>
+struct espy_field {
+    const T &value;
+    uint8_t width;
+    bool right;
+};
+
+template<typename T>
+inline espy_field<T> align_left(const T &value, uint8_t width) {
+    return {value, width, false};
+}
+
+template<typename T>
+inline espy_field<T> align_right(const T &value, uint8_t width) {
+    return {value, width, true};
+}
+
+/*
+ * Writes values straight into a row buffer of width + 1 chars.
+ * Everything past the width is dropped. No format string, no heap.
+ */
+class EspyRowWriter {
+public:
+    EspyRowWriter(char *_row, uint8_t width);
+
+    void put(char c);
+
+    void put(const char *s);
+
+    void put(const __FlashStringHelper *s);
+
+    void put(const String &s);
+
+    void put(int value);
+
+    void put(unsigned int value);
+
+    void put(long value);
+
+    void put(unsigned long value);
+
+    void put(const IPAddress &ip);
+
+    template<typename T>
+    void put(const espy_field<T> &field) {
+        char buf[DISPLAY_COLS];
+        EspyRowWriter value(buf, field.width < DISPLAY_COLS ? field.width : DISPLAY_COLS);
+        value.put(field.value);
+
+        uint8_t length = value.length();
+        if (field.right) {
+            pad(field.width - length);
+        }
+        for (uint8_t i = 0; i < length; i++) {
+            put(buf[i]);
+        }
+        if (!field.right) {
+            pad(field.width - length);
+        }
+    }
+
+    // characters written so far
+    uint8_t length() const;
+
+    // blank the rest of the row and terminate it
+    void fill();
+
+private:
+    char *row;
+    char *pos;
+    char *end;
+
+    void pad(int count);
+};
+
+inline void espy_format(EspyRowWriter &) {
+}
+
+template<typename T, typename... Args>
+inline void espy_format(EspyRowWriter &writer, const T &value, const Args &... args) {
+    writer.put(value);
+    espy_format(writer, args...);
+}
+
+
+#endif //_ESPY_ESPYFORMAT_H_
@@ -0,0 +1,91 @@
+/* -*- mode: C++; -*-
+ *
+ * CGRAM glyph cache for the LCD.
+ */
+
+#include <Arduino.h>
+
+#ifndef _ESPY_ESPYGLYPHCACHE_H_
+#define _ESPY_ESPYGLYPHCACHE_H_
+
+#include <espy.h>
+
+// number of programmable glyphs on the HD44780
+#define GLYPH_SLOTS 8
+
+// glyph rows (5x8 font)
+#define GLYPH_ROWS 8
+
+// pixel columns of a glyph, a bar graph cell has this many steps
+#define GLYPH_BAR_COLUMNS 5
+
+// character code of slot 0. CGRAM is mirrored at 8-15, which keeps
+// glyphs clear of the string terminator.
+#define GLYPH_CHAR_BASE 8
+
+enum glyph_id {
+    GLYPH_SIGNAL_0 = 0,     // signal strength, no bars .. three bars
+    GLYPH_SIGNAL_1,
+    GLYPH_SIGNAL_2,
+    GLYPH_SIGNAL_3,
+    GLYPH_LED_OFF,          // led states, same order as led_state
+    GLYPH_LED_ON,
+    GLYPH_LED_IGNORE,
+    GLYPH_LED_SLOW,
+    GLYPH_LED_FAST,
+    GLYPH_BAR_1,            // bar graph, one to four columns filled (use 0xff for a full cell)
+    GLYPH_BAR_2,
+    GLYPH_BAR_3,
+    GLYPH_BAR_4,
+    GLYPH_BUILTIN_COUNT,
+
+    GLYPH_USER = 0x80       // first id for glyphs with caller supplied bitmaps
+};
+
+/*
+ * Maps glyph ids to the 8 CGRAM slots. Glyphs are loaded on demand,
+ * the least recently requested slot is evicted and a slot is only
+ * uploaded again when its bitmap changes.
+ *
+ * Slots in the pinned mask (bit n for slot n) are on screen and are
+ * never evicted. If all slots are pinned, the fallback character is
+ * returned instead.
+ */
+class EspyGlyphCache {
+public:
+    EspyGlyphCache();
+
+    // character code for a builtin glyph
+    char get(uint8_t id, uint8_t pinned = 0);
+
+    // character code for a glyph with the given bitmap (GLYPH_ROWS bytes)
+    char get(uint8_t id, const uint8_t *bitmap, uint8_t pinned = 0);
+
+    // pinned mask for the slots used in the text
+    static uint8_t slots_used(const char *text, size_t length);
+
+    // character shown instead of a builtin glyph if there is no display
+    static char fallback(uint8_t id);
+
+    // write all changed slots to CGRAM
+    void upload(EspyLcdBus &bus);
+
+    // CGRAM may be corrupt, upload every slot again
+    void invalidate();
+
+private:
+    struct glyph_slot {
+        uint8_t id;
+        bool dirty;
+        uint32_t last_used;
+        uint8_t bitmap[GLYPH_ROWS];
+    };
+
+    glyph_slot slots[GLYPH_SLOTS]{};
+    uint32_t clock = 0;
+
+    uint8_t find(uint8_t id, uint8_t pinned);
+};
+
+
+#endif //_ESPY_ESPYGLYPHCACHE_H_
@@ -3,7 +3,6 @@
  */
 
 #include <Wire.h>
-#include <PCF8574.h>
 #include <LiquidCrystal_I2C.h>
 
 #include <espy.h>
@@ -41,6 +40,14 @@
 
 #define LED_IO_MASK (LED_IO_0 | LED_IO_1 | LED_IO_2 | LED_IO_3 | LED_IO_4 )
 
+class EspyPort;
+
+class EspyLcdBus;
+
+class EspyLcd;
+
+struct lcd_frame;
+
 /*
  * Contains all the hardware information.
  */
@@ -52,18 +59,30 @@ public:
     uint8_t pcf_address = 0xffu;
     int error = HW_NO_ERROR;
 
-    PCF8574 *pcf;
+    EspyPort *port;
     LiquidCrystal_I2C *display;
+    EspyLcdBus *lcd_bus;
+    EspyLcd *lcd;
 
+    // false while the key scanner sleeps waiting for the INT line
+    bool key_scan_active = true;
+
+    // stage the led value, it is written with the next key scan
+    // (or right away if the key scanner sleeps)
     void leds(uint8_t led_value) const;
 
-    void text(const char *text[DISPLAY_ROWS]) const;
+    void text(const lcd_frame &frame) const;
 
+    // sync the port expander (pending led write and key read in one bus cycle)
     uint8_t keys() const;
 
 private:
     void _init_i2c_bus();
 
+    void scan(uint8_t first, uint8_t last);
+
+    bool self_test() const;
+
     void init_display();
 
     void init_pcf();
@@ -0,0 +1,142 @@
+/* -*- mode: C++; -*-
+ *
+ * I2C bus manager: clock selection, error counters and bus recovery.
+ */
+
+#include <Wire.h>
+
+#ifndef _ESPY_ESPYI2C_H_
+#define _ESPY_ESPYI2C_H_
+
+#include <espy.h>
+
+// bus clocks, fastest first. The bus starts at the first one and
+// steps down when errors appear.
+#define I2C_CLOCKS {400000ul, 200000ul, 100000ul}
+#define I2C_CLOCK_COUNT 3
+
+// data NACKs and bus errors in a row on one device before the clock is
+// stepped down. Address NACKs (no device) do not count.
+#define I2C_ERROR_LIMIT 3
+
+// devices with their own counters
+#define I2C_MAX_DEVICES 4
+
+// SCL pulses to release a slave holding SDA (one byte plus ack)
+#define I2C_RECOVERY_CLOCKS 9
+
+// queued transactions and their size. One transaction holds the bus
+// for about 0.8 ms at 400 kHz.
+#define I2C_QUEUE_SLOTS 32
+#define I2C_QUEUE_CHUNK 32
+
+// time the queue may use in one scheduler pass
+#define I2C_TICK_BUDGET_US 1000
+
+// Wire.endTransmission() results
+#define I2C_OK 0
+#define I2C_ADDRESS_NACK 2
+#define I2C_DATA_NACK 3
+#define I2C_BUS_ERROR 4
+
+struct i2c_device_stats {
+    uint8_t address = 0xffu;
+    uint32_t transactions = 0;
+    uint32_t nacks = 0;
+    uint32_t timeouts = 0;      // bus errors and short reads
+    uint32_t mismatches = 0;    // self test read back the wrong value
+    uint8_t errors = 0;         // errors in a row
+};
+
+// a write waiting in the queue
+struct i2c_transaction {
+    uint8_t address;
+    uint8_t length;
+    uint8_t data[I2C_QUEUE_CHUNK];
+};
+
+/*
+ * Owns the Wire bus. All transactions that should be counted go through
+ * end_transmission() and request() instead of calling Wire directly.
+ *
+ * Bulk writes (the display) are queued and sent by the i2c task a few at
+ * a time. Direct transactions (the key scan) run between two queued ones,
+ * so they never wait for more than one of them.
+ */
+class EspyI2c {
+public:
+    uint32_t clock = 0;
+    uint32_t recoveries = 0;
+    i2c_device_stats devices[I2C_MAX_DEVICES];
+
+    uint32_t queue_stalls = 0;      // submits that had to wait for a free slot
+    uint32_t submitted = 0;         // transactions queued so far
+    uint32_t sent = 0;              // queued transactions sent so far
+
+    // called after the clock changed
+    void (*clock_changed)(uint32_t hz) = nullptr;
+
+    // called after the bus was recovered from a timeout. Writes around
+    // the timeout may have been lost.
+    void (*recovered)() = nullptr;
+
+    // called when a transaction was queued
+    void (*queue_wakeup)() = nullptr;
+
+    // called after a queued transaction was sent, with the new value of sent
+    void (*transaction_sent)(uint32_t count) = nullptr;
+
+    // recover the bus if needed and start it at the fastest clock
+    void begin(uint8_t sda, uint8_t scl);
+
+    // true if a device acknowledges the address. Not counted.
+    static bool probe(uint8_t address);
+
+    // write the patterns and read them back, comparing the bits in mask.
+    // Leaves the device at restore.
+    bool self_test(uint8_t address, uint8_t mask, uint8_t restore);
+
+    // Wire.endTransmission() with error accounting
+    uint8_t end_transmission(uint8_t address, bool stop = true);
+
+    // Wire.requestFrom() with error accounting, returns the bytes read
+    uint8_t request(uint8_t address, uint8_t count);
+
+    // queue a write of up to I2C_QUEUE_CHUNK bytes. If the queue is full,
+    // the oldest transaction is sent first.
+    void submit(uint8_t address, const uint8_t *data, uint8_t length);
+
+    // send queued transactions for up to budget_us (at least one).
+    // returns false if the queue is empty afterwards.
+    bool run(uint32_t budget_us);
+
+    // next slower clock, false if already at the slowest
+    bool step_down();
+
+    // clock SCL until a slave holding SDA lets go, then send a stop
+    void recover();
+
+    const i2c_device_stats *stats(uint8_t address) const;
+
+    uint32_t total_nacks() const;
+
+    uint32_t total_timeouts() const;
+
+private:
+    uint8_t sda = 0;
+    uint8_t scl = 0;
+    uint8_t clock_index = 0;
+
+    EspyQueue<i2c_transaction, I2C_QUEUE_SLOTS> queue;
+
+    void send(const i2c_transaction &transaction);
+
+    i2c_device_stats &device(uint8_t address);
+
+    void set_clock(uint8_t index);
+
+    void account(uint8_t address, uint8_t result);
+};
+
+
+#endif //_ESPY_ESPYI2C_H_
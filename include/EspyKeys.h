@@ -19,31 +19,97 @@
 // long press time: 2 seconds
 #define LONG_PRESS_TIME_MS 2000
 
-typedef void (*key_func)(void);
+// autorepeat: first repeat after 500 ms, then every 150 ms
+#define KEY_REPEAT_DELAY_MS 500
+#define KEY_REPEAT_RATE_MS 150
+
+// second press within 300 ms of a click is a double click
+#define DOUBLE_CLICK_TIME_MS 300
+
+// number of keys on the keyboard
+#define KEY_COUNT 3
+
+// GPIO pin wired to the PCF8574 INT line (e.g. 3 / RX on the ESP01, which
+// rules out Serial). -1 polls the expander forever.
+#define KEY_INT_PIN -1
+
+// number of queued key events, must be a power of two
+#define KEY_EVENT_QUEUE_SIZE 16
+
+enum key_event_type {
+    KEY_PRESS = 0,          // key went down (debounced)
+    KEY_LONG_PRESS = 1,     // key held down for the long press time
+    KEY_RELEASE = 2,        // key released without long press, repeat or double click. With double
+                            // click enabled, sent when the double click time passed without a second press
+    KEY_REPEAT = 3,         // key held down, autorepeat
+    KEY_DOUBLE_CLICK = 4    // second press within the double click time (instead of KEY_PRESS)
+};
+
+struct key_event {
+    uint32_t time;          // millis() of the raw edge for press and release, else when the event was due
+    uint8_t key;
+    key_event_type type;
+};
+
+/*
+ * Timing for a single key. A time of 0 disables the feature.
+ */
+struct key_profile {
+    uint16_t debounce_ms;
+    uint16_t long_press_ms;
+    uint16_t repeat_delay_ms;
+    uint16_t repeat_rate_ms;
+    uint16_t double_click_ms;
+};
 
 struct key_control {
     bool pressed = false;
     bool long_pressed = false;
-    int press_count = 0;
-    int release_count = 0;
-    key_func on_press = nullptr;
-    key_func on_long_press = nullptr;
-    key_func on_release = nullptr;
+    bool consumed = false;          // long press, repeat or double click happened, no release event
+    bool clicked = false;           // last release was a click, a double click may follow
+    bool bouncing = false;          // raw input differs from the debounced state
+    uint32_t edge_time = 0;         // when the raw input first left the debounced state
+    uint32_t press_time = 0;
+    uint32_t release_time = 0;
+    uint32_t next_repeat = 0;
+    key_profile profile = {DEBOUNCE_TIME_MS, LONG_PRESS_TIME_MS, 0, 0, 0};
 };
 
 
 class EspyKeys {
 public:
-    explicit EspyKeys(EspyHardware &_hardware);
+    explicit EspyKeys(EspyHardware &_hardware, int8_t _int_pin = KEY_INT_PIN);
 
-    key_control keys[3];
+    key_control keys[KEY_COUNT];
 
-    void scan();
+    // filled by scan, drained by the menu (or any other single consumer)
+    EspyQueue<key_event, KEY_EVENT_QUEUE_SIZE> events;
+
+    // scan the keys. late_ms is how long the scan was held up by other
+    // tasks, events are stamped with the time the scan was due.
+    // Returns false if the scanner can sleep until the next interrupt
+    // (never in polling mode).
+    bool scan(uint32_t late_ms = 0);
+
+    // true if the INT line signaled a change since the last scan
+    static bool wakeup();
 
     uint8_t state();
 
+    void set_profile(uint8_t key, const key_profile &profile);
+
 private:
     EspyHardware &hardware;         // Reference to the detected hardware
+    EspyDebouncer debouncer;
+    int8_t int_pin;
+
+    static volatile bool pending;
+
+    // queue an event. A full queue leaves the key state alone, so the
+    // event is detected again at the next scan instead of being lost.
+    bool emit(uint8_t key, key_event_type type, uint32_t time);
+
+    static void IRAM_ATTR on_interrupt();
 };
 
 
@@ -0,0 +1,83 @@
+/* -*- mode: C++; -*-
+ *
+ * Shadow frame buffer and diff renderer for the LCD.
+ */
+
+#ifndef _ESPY_ESPYLCD_H_
+#define _ESPY_ESPYLCD_H_
+
+#include <espy.h>
+
+// unchanged cells between two changed runs that are rewritten instead of
+// issuing another setCursor (a cursor move costs as much as one character)
+#define LCD_MAX_RUN_GAP 1
+
+// DDRAM length of a display line. The visible window can be shifted along it.
+#define LCD_LINE_LENGTH 40
+
+// blanks between the end of a marquee text and its next start
+#define LCD_MARQUEE_GAP 4
+
+// longest marquee text that fits the display RAM with its gap. Longer
+// text is scrolled by rewriting the visible window.
+#define LCD_MARQUEE_SHIFT_MAX (LCD_LINE_LENGTH - LCD_MARQUEE_GAP)
+
+// longest marquee text (e.g. a 40 character parameter value)
+#define LCD_MARQUEE_MAX 64
+
+/*
+ * One frame for the panel. A row with a marquee shows the marquee text
+ * (padded with blanks to the line length, or followed by LCD_MARQUEE_GAP
+ * blanks if it is longer) scrolled left by step cells instead of its text.
+ */
+struct lcd_frame {
+    const char *text[DISPLAY_ROWS];
+    const char *marquee[DISPLAY_ROWS];  // nullptr if the row does not scroll
+    uint32_t step;
+};
+
+/*
+ * Keeps a copy of the display RAM and the display shift and only sends
+ * the runs of cells that changed. Never clears the display.
+ *
+ * Marquee rows are scrolled either by shifting the display (one command,
+ * the full text is already in the display RAM) or by rewriting the visible
+ * window. Shifting moves all rows, so the rows that do not scroll have to be
+ * rewritten at the new position. Every frame uses the cheaper of the two.
+ *
+ * A step costs one command only if all other rows are blank. With a title
+ * row it costs the shift plus the non-blank cells of the title, which
+ * is still less than a window rewrite for short titles. Text longer than
+ * LCD_MARQUEE_SHIFT_MAX always rewrites the window.
+ */
+class EspyLcd {
+public:
+    explicit EspyLcd(EspyLcdBus &_bus);
+
+    EspyGlyphCache glyphs;
+
+    // upload changed glyphs, then render the frame, sending only
+    // the cells that differ from the panel
+    void render(const lcd_frame &frame);
+
+    // forget the panel contents, the next render rewrites every cell and glyph
+    void invalidate();
+
+private:
+    EspyLcdBus &bus;
+    char shadow[DISPLAY_ROWS][LCD_LINE_LENGTH]{};
+    uint8_t shift = 0;      // display RAM address shown in the first column
+
+    typedef char lcd_image[DISPLAY_ROWS][LCD_LINE_LENGTH];
+
+    static void build(lcd_image &image, const lcd_frame &frame, uint8_t at_shift, bool full_marquee);
+
+    uint16_t diff(const lcd_image &image, bool send);
+
+    uint8_t shift_steps(uint8_t to, bool *left) const;
+
+    void write_run(uint8_t row, uint8_t start, uint8_t end, const char *line);
+};
+
+
+#endif //_ESPY_ESPYLCD_H_
@@ -0,0 +1,94 @@
+/* -*- mode: C++; -*-
+ *
+ * Burst mode I2C transport for the HD44780 backpack.
+ */
+
+#include <Wire.h>
+#include <LiquidCrystal_I2C.h>
+
+#ifndef _ESPY_ESPYLCDBUS_H_
+#define _ESPY_ESPYLCDBUS_H_
+
+#include <espy.h>
+
+// largest single transaction, short enough to not hold up the key scan
+#define LCD_BUS_BUFFER I2C_QUEUE_CHUNK
+
+// bytes on the wire per character / command (two nibbles, each with
+// an enable strobe)
+#define LCD_BUS_BYTES_PER_SEND 4
+
+// execution time of a data write or set DDRAM address on the HD44780
+#define LCD_EXEC_TIME_US 37
+
+// default I2C bus clock
+#define LCD_BUS_CLOCK_HZ 100000ul
+
+/*
+ * bus statistics. "frame" is everything sent between begin_frame and end_frame.
+ * The frame time runs from begin_frame until the i2c task has sent the last
+ * transaction of the frame. The queue time stops at end_frame.
+ */
+struct lcd_bus_stats {
+    uint32_t frames = 0;
+    uint32_t bytes = 0;             // total bytes on the bus
+    uint32_t transactions = 0;      // total Wire transactions
+    uint32_t last_frame_bytes = 0;
+    uint32_t last_frame_transactions = 0;
+    uint32_t last_frame_us = 0;
+    uint32_t max_frame_us = 0;
+    uint32_t last_queue_us = 0;
+};
+
+/*
+ * Packs commands and characters into as few transactions as the
+ * buffer allows and queues them on the bus. The controller is initialized by LiquidCrystal_I2C,
+ * this only takes over the data path.
+ */
+class EspyLcdBus {
+public:
+    EspyLcdBus(LiquidCrystal_I2C &_display, uint8_t _address);
+
+    lcd_bus_stats stats;
+
+    // adjust the padding between characters for the bus clock
+    void set_clock(uint32_t hz);
+
+    void set_cursor(uint8_t col, uint8_t row);
+
+    void command(uint8_t value);
+
+    void write(uint8_t value);
+
+    // send all pending bytes
+    void flush();
+
+    void begin_frame();
+
+    void end_frame();
+
+    // the i2c queue sent its count-th transaction
+    void sent(uint32_t count);
+
+private:
+    LiquidCrystal_I2C &display;
+    uint8_t address;
+    uint8_t backlight = LCD_BACKLIGHT;
+    uint8_t mode = 0xffu;           // register select currently driven on the bus
+    uint8_t pad = 0;                // idle bytes after each send to cover the execution time
+
+    uint8_t buffer[LCD_BUS_BUFFER]{};
+    uint8_t length = 0;
+
+    uint32_t frame_start = 0;
+    uint32_t frame_bytes = 0;
+    uint32_t frame_transactions = 0;
+    uint32_t frame_last = 0;        // i2c.submitted after the last transaction of the frame
+    uint32_t pending_start = 0;     // frame_start of the frame being sent
+    bool frame_pending = false;     // frame queued but not sent yet
+
+    void send(uint8_t value, uint8_t rs);
+};
+
+
+#endif //_ESPY_ESPYLCDBUS_H_
@@ -0,0 +1,105 @@
+/* -*- mode: C++; -*-
+ *
+ * Loop latency histogram and blocking call watchdog.
+ */
+
+#include <Arduino.h>
+#include <Ticker.h>
+
+#ifndef _ESPY_ESPYLOOPMONITOR_H_
+#define _ESPY_ESPYLOOPMONITOR_H_
+
+#include <espy.h>
+
+// histogram bucket n counts gaps of 2^n to 2^(n+1)-1 us (1 us ... 16 s)
+#define LOOP_HISTOGRAM_BUCKETS 24
+
+// loop gaps longer than this are recorded with the activity that caused them
+#define LOOP_SLOW_US 50000ul
+
+// early warning. The software watchdog fires after about 3.2 s.
+#define LOOP_WARN_MS 1500ul
+
+// period of the watch timer
+#define LOOP_WATCH_MS 250ul
+
+// RTC user memory block of the warning record, after the OTA blocks
+// and before the boot record
+#define LOOP_MONITOR_RTC_BLOCK 32
+
+#define LOOP_ACTIVITY_LENGTH 16
+
+// the activity when the last warning fired, kept across a watchdog reset
+struct loop_warning {
+    uint32_t magic;
+    uint32_t stalled_ms;
+    char activity[LOOP_ACTIVITY_LENGTH];
+};
+
+/*
+ * Measures the time between two loop() iterations. Tasks and web handlers
+ * mark themselves as the current activity (EspyActivity, EspyTaskTimer),
+ * so a slow iteration can be blamed on the longest one.
+ *
+ * A timer checks that the loop is still moving and records the current
+ * activity in RTC memory if it is not. The timer runs whenever the stuck code
+ * yields (delay(), WiFi scans); code that never yields is caught by the
+ * software watchdog of the core.
+ */
+class EspyLoopMonitor {
+public:
+    uint32_t histogram[LOOP_HISTOGRAM_BUCKETS]{};
+    uint32_t slow = 0;                      // gaps longer than LOOP_SLOW_US
+    uint32_t max_gap_us = 0;
+    const char *max_gap_activity = nullptr;
+    uint32_t last_slow_us = 0;
+    const char *last_slow_activity = nullptr;
+    uint32_t warnings = 0;
+
+    // the warning before the last reset if that reset was a watchdog, or nullptr
+    const loop_warning *watchdog = nullptr;
+
+    // look for a warning from before a watchdog reset, start the watch timer
+    void begin();
+
+    // call at the top of loop()
+    void tick();
+
+    // mark name as running, returns the activity to restore
+    const char *enter(const char *name);
+
+    // restore the previous activity. elapsed_us is how long name ran.
+    void leave(const char *previous, const char *name, uint32_t elapsed_us);
+
+private:
+    Ticker timer;
+    uint32_t last_tick_us = 0;
+    volatile uint32_t last_tick_ms = 0;
+    volatile const char *activity = nullptr;
+    const char *slowest = nullptr;          // longest activity in the current iteration
+    uint32_t slowest_us = 0;
+    bool warned = false;
+    loop_warning warning{};
+
+    static void watch();
+};
+
+/*
+ * Marks a block as the current activity:
+ *
+ *     EspyActivity activity("http /r");
+ */
+class EspyActivity {
+public:
+    explicit EspyActivity(const char *_name);
+
+    ~EspyActivity();
+
+private:
+    const char *name;
+    const char *previous;
+    uint32_t start;
+};
+
+
+#endif //_ESPY_ESPYLOOPMONITOR_H_
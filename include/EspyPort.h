@@ -0,0 +1,52 @@
+/* -*- mode: C++; -*-
+ *
+ * Cached access to the PCF8574 port expander.
+ */
+
+#include <Wire.h>
+
+#ifndef _ESPY_ESPYPORT_H_
+#define _ESPY_ESPYPORT_H_
+
+#include <espy.h>
+
+/*
+ * Keeps the last byte written to the expander and the last byte read from it.
+ * Output changes are staged and go out together with the next input read
+ * in a single bus cycle (write, repeated start, read).
+ */
+class EspyPort {
+public:
+    explicit EspyPort(uint8_t _address);
+
+    uint32_t transactions = 0;      // bus cycles issued
+    uint32_t skipped_writes = 0;    // writes dropped because the port already had the value
+
+    // drive all pins high (inputs and leds off)
+    void begin();
+
+    // stage a new output value. Written at the next sync or flush.
+    void output(uint8_t value);
+
+    // last value read from the port
+    uint8_t input() const;
+
+    // write the staged output (if it changed) and read the port in one bus cycle
+    void sync();
+
+    // write the staged output if it changed, do not read
+    void flush();
+
+private:
+    uint8_t address;
+    uint8_t staged = 0xffu;
+    uint8_t written = 0xffu;
+    uint8_t last_input = 0xffu;
+
+    bool dirty() const;
+
+    bool write(bool stop);
+};
+
+
+#endif //_ESPY_ESPYPORT_H_
@@ -0,0 +1,69 @@
+/* -*- mode: C++; -*-
+ *
+ * Lock-free single producer / single consumer ring buffer.
+ */
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef _ESPY_ESPYQUEUE_H_
+#define _ESPY_ESPYQUEUE_H_
+
+/*
+ * Fixed size ring buffer. One side may only push, the other side may only pop.
+ * push does not lock or allocate and may be called from an interrupt.
+ * SIZE must be a power of two and at most 128.
+ */
+template<typename T, uint8_t SIZE>
+class EspyQueue {
+    static_assert(SIZE > 0 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two <= 128");
+
+public:
+    // returns false if the queue is full, the element was not added
+    bool IRAM_ATTR push(const T &element) {
+        uint8_t h = head.load(std::memory_order_relaxed);
+        uint8_t used = (uint8_t) (h - tail.load(std::memory_order_acquire));
+        if (used >= SIZE) {
+            return false;
+        }
+
+        elements[h & (SIZE - 1)] = element;
+        head.store((uint8_t) (h + 1), std::memory_order_release);
+
+        if (used + 1 > high_water) {
+            high_water = used + 1;
+        }
+        return true;
+    }
+
+    // returns false if the queue is empty
+    bool pop(T &element) {
+        uint8_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        element = elements[t & (SIZE - 1)];
+        tail.store((uint8_t) (t + 1), std::memory_order_release);
+        return true;
+    }
+
+    uint8_t size() const {
+        return (uint8_t) (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+    }
+
+    // largest number of elements queued at any time
+    uint8_t high_water_mark() const {
+        return high_water;
+    }
+
+private:
+    T elements[SIZE]{};
+    // free running indices, only the producer writes head, only the consumer writes tail
+    std::atomic<uint8_t> head{0};
+    std::atomic<uint8_t> tail{0};
+    volatile uint8_t high_water = 0;
+};
+
+
+#endif //_ESPY_ESPYQUEUE_H_
@@ -0,0 +1,59 @@
+/* -*- mode: C++; -*-
+ *
+ * Run time statistics for the scheduler tasks.
+ */
+
+#include <TaskSchedulerDeclarations.h>
+
+#ifndef _ESPY_ESPYTASKSTATS_H_
+#define _ESPY_ESPYTASKSTATS_H_
+
+#include <espy.h>
+
+/*
+ * Statistics for one task. All instances are chained in creation order
+ * starting at EspyTaskStats::first.
+ */
+class EspyTaskStats {
+public:
+    explicit EspyTaskStats(const char *_name);
+
+    const char *name;
+    uint32_t calls = 0;
+    uint64_t total_us = 0;
+    uint32_t max_us = 0;
+    uint32_t last_jitter_ms = 0;    // start delay against the schedule
+    uint32_t max_jitter_ms = 0;
+    uint32_t overruns = 0;          // started after the next iteration was already due
+
+    EspyTaskStats *next = nullptr;
+
+    static EspyTaskStats *first;
+
+    uint32_t average_us() const;
+
+    void reset();
+};
+
+/*
+ * Times one task iteration. Create at the top of the task callback:
+ *
+ *     EspyTaskTimer timer(display_stats, displayTask);
+ *
+ * Costs two micros() calls and two reads from the task. Also marks the task
+ * as the current activity for the loop monitor.
+ */
+class EspyTaskTimer {
+public:
+    EspyTaskTimer(EspyTaskStats &_stats, Task &task);
+
+    ~EspyTaskTimer();
+
+private:
+    EspyTaskStats &stats;
+    const char *previous;   // activity for the loop monitor
+    uint32_t start;
+};
+
+
+#endif //_ESPY_ESPYTASKSTATS_H_
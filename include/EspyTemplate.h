@@ -0,0 +1,69 @@
+/* -*- mode: C++; -*-
+ *
+ * Streaming HTML templates.
+ */
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <memory>
+
+#ifndef _ESPY_ESPYTEMPLATE_H_
+#define _ESPY_ESPYTEMPLATE_H_
+
+// room for a formatted placeholder value (numbers, addresses, SSIDs)
+#define TEMPLATE_SCRATCH_SIZE 48
+
+/*
+ * A page made of PROGMEM parts with {x} placeholders (one character
+ * between the braces). The parts are scanned once while the response is
+ * sent, values are copied straight into the outgoing chunk. Nothing grows
+ * with the page size.
+ *
+ * The page object lives until the response is done, so values must stay
+ * valid until then, or be formatted into scratch.
+ */
+class EspyTemplate {
+public:
+    // parts is a PROGMEM array of PROGMEM strings
+    EspyTemplate(PGM_P const *parts, uint8_t count);
+
+    virtual ~EspyTemplate() = default;
+
+    // next piece of the page, up to len bytes. Returns 0 at the end.
+    size_t fill(uint8_t *data, size_t len);
+
+    // send the page as a chunked response
+    static void send(AsyncWebServerRequest *request, const std::shared_ptr<EspyTemplate> &page,
+                     const char *content_type = "text/html");
+
+protected:
+    char scratch[TEMPLATE_SCRATCH_SIZE]{};
+
+    // number of times a part is rendered. 0 leaves it out.
+    virtual uint8_t repeat(PGM_P part) {
+        return 1;
+    }
+
+    // the template for one rendering of a part, another PROGMEM string may be returned
+    virtual PGM_P text(PGM_P part, uint8_t item) {
+        return part;
+    }
+
+    // value of {key}. nullptr keeps the placeholder text as it is.
+    virtual const char *value(PGM_P part, uint8_t item, char key) = 0;
+
+private:
+    PGM_P const *_parts;
+    uint8_t _count;
+
+    uint8_t _part = 0;
+    uint8_t _item = 0;
+    PGM_P _text = nullptr;      // current rendering, nullptr if the next one has to be found
+    const char *_value = nullptr;
+
+    // move to the next rendering, false at the end of the page
+    bool next();
+};
+
+
+#endif //_ESPY_ESPYTEMPLATE_H_
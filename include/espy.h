@@ -8,11 +8,27 @@
 
 #undef _ESPY_DEBUG
 
+// send LCD updates through LiquidCrystal_I2C instead of the burst transport
+#undef _ESPY_LCD_LEGACY_BUS
+
 #include <TaskSchedulerDeclarations.h>
 
+#include <EspyArena.h>
+#include <EspyQueue.h>
+#include <EspyTaskStats.h>
+#include <EspyLoopMonitor.h>
+#include <EspyBootCache.h>
+#include <EspyI2c.h>
 #include <EspyHardware.h>
+#include <EspyPort.h>
+#include <EspyLcdBus.h>
+#include <EspyGlyphCache.h>
+#include <EspyLcd.h>
 #include <EspyBlinker.h>
+#include <EspyFormat.h>
+#include <EspyTemplate.h>
 #include <EspyDisplay.h>
+#include <EspyDebouncer.h>
 #include <EspyKeys.h>
 #include <menu.h>
 #include <CustomWifiManager.h>
@@ -27,16 +43,19 @@ void display_task();
 // keyboard scan task
 void keyboard_task();
 
+// i2c queue task
+void i2c_task();
+
 
 // dns
 void dns_enable();
 
 void dns_disable();
 
-void dns_setup(Scheduler &scheduler);
+void dns_setup(Scheduler &network);
 
 // wifi config portal
-void wifi_setup(Scheduler &scheduler);
+void wifi_setup(Scheduler &network);
 
 void wifi_setup_activate(uint8_t param);
 
@@ -44,10 +63,20 @@ void wifi_reset(uint8_t param);
 
 // stuff
 
+extern EspyArena boot_arena;
+extern EspyBootCache boot_cache;
+extern EspyI2c i2c;
+extern EspyLoopMonitor loop_monitor;
 extern EspyDisplayBuffer menu_buffer;
+extern Task menuTask;
+extern EspyTaskStats menu_stats;
+extern uint32_t key_latency_ms;
+extern uint32_t key_latency_max_ms;
+extern EspyHardware *hardware;
 extern EspyDisplay *display;
 extern EspyKeys *keys;
 extern LCDMenuLib2 LCDML;
 extern CustomWiFiManager *wifiManager;
+extern CustomWiFiManagerParameter mqtt_server;
 
 #endif // _ESPY_H_
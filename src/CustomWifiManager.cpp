@@ -12,8 +12,26 @@
  **************************************************************/
 
 
+#include <EEPROM.h>
+
 #include "CustomWifiManager.h"
 
+#include <espy.h>
+
+static_assert(BOOT_CACHE_EEPROM_OFFSET + sizeof(boot_record) <= WIFI_MANAGER_CREDENTIALS_EEPROM_OFFSET,
+              "boot record overlaps the saved networks");
+static_assert(WIFI_MANAGER_CREDENTIALS_EEPROM_OFFSET + sizeof(WiFiCredentialStore) <= ESPY_EEPROM_SIZE,
+              "saved networks do not fit the EEPROM");
+
+// SSID hash for the dedupe table, checksum of the saved networks (FNV-1a)
+static uint32_t fnvHash(const uint8_t *data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
 /*
  * Custom parameters
  */
@@ -21,7 +39,8 @@
 CustomWiFiManagerParameter::CustomWiFiManagerParameter(const char *id, const char *placeholder, const char *defaultValue, int length, const char *custom)
         : _id(id), _placeholder(placeholder), _length(length), _customHTML(custom) {
 
-    _value = new char[_length + 1];
+    // parameters live as long as the program
+    _value = (char *) boot_arena.allocate(_length + 1, 1);
     memset(_value, '\0', _length + 1);
 
     if (defaultValue != nullptr) {
@@ -54,26 +73,207 @@ const char *CustomWiFiManagerParameter::getCustomHTML() {
  */
 
 CustomWiFiManager::CustomWiFiManager(AsyncWebServer *server)
-        : _server(server), _config_portal_last_wifi_scan_networks(nullptr) {
+        : _server(server) {
+    loadCredentials();
 }
 
 /*
  * Task for the regular operation. Drives connection to the Wifi.
  */
-void CustomWiFiManager::connectTask() {
-    if (connectionRetries == 0) {
-        // attempt to connect;
-        WiFi.mode(WIFI_STA);
-        // use stored credentials
-        connectWifi();
-        connectionRetries = 1;
-    } else if (WiFi.status() == WL_CONNECTED) {
-        connectionRetries = 1; // not 0, would reconnect!
-    } else {
-        if (++connectionRetries >= (WIFI_MANAGER_MAX_RETRY_TIME_MS / WIFI_MANAGER_CONNECTION_TASK_TIME_MS)) {
-            connectionRetries = 0; // re-initialize
+uint32_t CustomWiFiManager::connectTask() {
+    if (!_got_ip_handler) {
+        // the event handlers drive the state, the SDK must not retry on its own
+        _got_ip_handler = WiFi.onStationModeGotIP([this](const WiFiEventStationModeGotIP &) {
+            _event_got_ip = true;
+            if (_connect_event_callback != nullptr) {
+                _connect_event_callback();
+            }
+        });
+        _disconnected_handler = WiFi.onStationModeDisconnected([this](const WiFiEventStationModeDisconnected &event) {
+            if (event.reason == WIFI_DISCONNECT_REASON_ASSOC_LEAVE) {
+                // our own disconnect, not a failure of the next attempt
+                return;
+            }
+            _event_disconnected = true;
+            if (_connect_event_callback != nullptr) {
+                _connect_event_callback();
+            }
+        });
+        WiFi.setAutoReconnect(false);
+    }
+
+    // the config portal may have joined while the task was off
+    if (_event_got_ip || (_connect_state != WIFI_STATE_CONNECTED && WiFi.status() == WL_CONNECTED)) {
+        _event_got_ip = false;
+        _event_disconnected = false;
+        if (_connect_state != WIFI_STATE_CONNECTED) {
+            setConnectState(WIFI_STATE_CONNECTED);
+            connectionRetries = 0;
+            _roam_weak_samples = 0;
+            saveConnection();
+            // also picks up the network configured before there was a store
+            addCredential(WiFi.SSID().c_str(), WiFi.psk().c_str());
+        }
+    } else if (_event_disconnected) {
+        _event_disconnected = false;
+        if (_connect_state == WIFI_STATE_CONNECTING || _connect_state == WIFI_STATE_CONNECTED) {
+            connectFailed();
         }
     }
+
+    uint32_t elapsed = millis() - _connect_state_since;
+
+    switch (_connect_state) {
+        case WIFI_STATE_START:
+            _event_disconnected = false;
+
+            // with several saved networks, pick one from a current scan.
+            // The cached access point is tried first without scanning.
+            if (_credentials.count > 1 && (_fast_connect_failed || boot_cache.record.wifi_channel == 0)) {
+                if (!_connect_scan_requested) {
+                    _connect_scan_requested = true;
+                    requestScan();
+                }
+                if (_scan_running || _scan_requested) {
+                    return WIFI_MANAGER_CONNECT_SCAN_WAIT_MS;
+                }
+            }
+            _connect_scan_requested = false;
+
+            // attempt to connect;
+            WiFi.mode(WIFI_STA);
+            // use stored credentials
+            connectWifi();
+            setConnectState(WIFI_STATE_CONNECTING);
+            return _fast_connecting ? WIFI_MANAGER_FAST_CONNECT_TIMEOUT_MS : WIFI_MANAGER_MAX_RETRY_TIME_MS;
+
+        case WIFI_STATE_CONNECTING: {
+            uint32_t timeout = _fast_connecting ? WIFI_MANAGER_FAST_CONNECT_TIMEOUT_MS : WIFI_MANAGER_MAX_RETRY_TIME_MS;
+            if (elapsed < timeout) {
+                return timeout - elapsed;
+            }
+            // no answer at all
+            connectFailed();
+            return _connect_state == WIFI_STATE_START ? 0 : _connect_backoff_ms;
+        }
+
+        case WIFI_STATE_BACKOFF:
+            if (elapsed < _connect_backoff_ms) {
+                return _connect_backoff_ms - elapsed;
+            }
+            setConnectState(WIFI_STATE_START);
+            return 0;
+
+        case WIFI_STATE_CONNECTED:
+        default:
+            return roamTask();
+    }
+}
+
+uint32_t CustomWiFiManager::roamTask() {
+    int8_t rssi = WiFi.RSSI();
+    if (rssi >= WIFI_MANAGER_ROAM_RSSI) {
+        _roam_weak_samples = 0;
+        return WIFI_MANAGER_CONNECTED_TASK_TIME_MS;
+    }
+
+    // a single weak sample is not a degraded link
+    if (_roam_weak_samples < WIFI_MANAGER_ROAM_SAMPLES) {
+        _roam_weak_samples++;
+        return WIFI_MANAGER_CONNECTED_TASK_TIME_MS;
+    }
+
+    if (millis() - _connect_state_since < WIFI_MANAGER_ROAM_HOLDOFF_MS) {
+        return WIFI_MANAGER_CONNECTED_TASK_TIME_MS;
+    }
+
+    // the results are there at the next check
+    if (requestScan()) {
+        return WIFI_MANAGER_CONNECTED_TASK_TIME_MS;
+    }
+
+    uint8_t credential;
+    const WiFiScanSet &set = scanResults();
+    int best = bestNetwork(set, rssi + WIFI_MANAGER_ROAM_HYSTERESIS_DB, WiFi.BSSID(), &credential);
+    if (best < 0) {
+        // nothing better around, wait for the holdoff before scanning again
+        setConnectState(WIFI_STATE_CONNECTED);
+        return WIFI_MANAGER_CONNECTED_TASK_TIME_MS;
+    }
+
+    const WiFiResult &network = set.networks[best];
+    const WiFiCredential &saved = _credentials.networks[credential];
+    disableWifi();
+    _fast_connecting = false;
+    _connection_saved = false;
+    _roam_weak_samples = 0;
+    configureIP();
+    WiFi.begin(saved.ssid, saved.password, network.channel, network.BSSID);
+    setConnectState(WIFI_STATE_CONNECTING);
+    return WIFI_MANAGER_MAX_RETRY_TIME_MS;
+}
+
+int CustomWiFiManager::bestNetwork(const WiFiScanSet &set, int min_rssi, const uint8_t *exclude_bssid,
+                                   uint8_t *credential) const {
+    // the set is sorted strongest first
+    for (uint8_t i = 0; i < set.count; i++) {
+        const WiFiResult &network = set.networks[i];
+        if (network.RSSI < min_rssi) {
+            break; // for
+        }
+        if (!qualityOk(network.RSSI)) {
+            break; // for
+        }
+        if (exclude_bssid != nullptr && memcmp(network.BSSID, exclude_bssid, sizeof(network.BSSID)) == 0) {
+            continue; // for
+        }
+        for (uint8_t c = 0; c < _credentials.count; c++) {
+            if (strncmp(_credentials.networks[c].ssid, set.ssid(i), 32) == 0) {
+                *credential = c;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+bool CustomWiFiManager::qualityOk(int RSSI) const {
+    return _config_minimum_quality == -1 || _config_minimum_quality < getRSSIasQuality(RSSI);
+}
+
+wifi_connect_state CustomWiFiManager::connectState() const {
+    return _connect_state;
+}
+
+void CustomWiFiManager::setConnectEventCallback(void (*func)()) {
+    _connect_event_callback = func;
+}
+
+void CustomWiFiManager::setConnectState(wifi_connect_state state) {
+    _connect_state = state;
+    _connect_state_since = millis();
+}
+
+void CustomWiFiManager::connectFailed() {
+    disableWifi();
+
+    if (_fast_connecting) {
+        // the cached access point is gone, scan right away
+        _fast_connecting = false;
+        _fast_connect_failed = true;
+        setConnectState(WIFI_STATE_START);
+        return;
+    }
+
+    // exponential backoff with jitter
+    uint32_t backoff = WIFI_MANAGER_BACKOFF_MAX_MS;
+    if (connectionRetries < 16) {
+        backoff = std::min((uint32_t) WIFI_MANAGER_BACKOFF_MIN_MS << connectionRetries, backoff);
+    }
+    connectionRetries++;
+
+    _connect_backoff_ms = backoff / 2 + ESP.random() % (backoff / 2 + 1);
+    setConnectState(WIFI_STATE_BACKOFF);
 }
 
 // do a single iteration through the configuration loop
@@ -91,6 +291,8 @@ bool CustomWiFiManager::configPortalMenu() {
 
     } else if (WiFi.status() == WL_CONNECTED) { //connected, switch back to station mode
         WiFi.mode(WIFI_STA);
+        saveConnection();
+        addCredential(_config_portal_ssid.c_str(), _config_portal_password.c_str());
 
         //notify that configuration has changed and any optional parameters should be saved
         if (_config_portal_save_settings_callback != nullptr) {
@@ -110,10 +312,17 @@ bool CustomWiFiManager::configPortalMenu() {
     return false; // not connected.
 }
 
+void CustomWiFiManager::disableConfigPortal() {
+    // a portal connection attempt still running is left to the connect task
+    _config_portal_connect_retries = -1;
+}
+
 /*
  * Start the configuration portal mode.
  */
 void CustomWiFiManager::enableConfigPortal(char const *apName, char const *apPassword) {
+    EspyActivity activity("portal start");
+
     //setup AP
     WiFi.mode(WIFI_AP_STA);
 
@@ -154,20 +363,125 @@ void CustomWiFiManager::enableConfigPortal(char const *apName, char const *apPas
     _server->begin(); // Web server start
 }
 
-void CustomWiFiManager::scanNetworkTask() {
-    disableWifi();
-    scan();
-    WiFi.begin(); // try to reconnect to AP
+bool CustomWiFiManager::scanNetworkTask() {
+    if (_scan_running) {
+        int8_t n = WiFi.scanComplete();
+        if (n == WIFI_SCAN_RUNNING) {
+            return true;
+        }
+        scanDone(n);
+        // a request with other limits came in while this one ran
+        return _scan_requested;
+    }
+
+    if (!_scan_requested) {
+        return false;
+    }
+    _scan_requested = false;
+
+    // the SDK can scan while connected. A connection attempt in progress
+    // has to stop and is restarted when the scan is done.
+    _scan_reconnect = WiFi.status() != WL_CONNECTED;
+    if (_scan_reconnect) {
+        disableWifi();
+    }
+
+    // the limits move to the published results when the scan succeeds
+    memcpy(_scan_running_ssid, _scan_ssid, sizeof(_scan_running_ssid));
+    _scan_running_channel = _scan_channel;
+
+    _scan_running = true;
+    WiFi.scanNetworks(true, _scan_running_ssid[0] != '\0', _scan_running_channel,
+                      _scan_running_ssid[0] != '\0' ? (uint8_t *) _scan_running_ssid : nullptr);
+    return true;
 }
 
-void CustomWiFiManager::resetSettings() {
-    WiFi.disconnect(true);
+bool CustomWiFiManager::requestScan(const char *ssid, uint8_t channel) {
+    if (ssid == nullptr) {
+        ssid = "";
+    }
+
+    // the running scan already has these limits
+    if (_scan_running && _scan_running_channel == channel && strncmp(_scan_running_ssid, ssid, 32) == 0) {
+        return true;
+    }
+
+    // cached results with the same limits are still good
+    if (scanCached(ssid, channel)) {
+        return false;
+    }
+
+    // other limits are queued behind a running scan. A newer request
+    // replaces a queued one.
+
+    strncpy(_scan_ssid, ssid, sizeof(_scan_ssid) - 1);
+    _scan_ssid[sizeof(_scan_ssid) - 1] = '\0';
+    _scan_channel = channel;
+    _scan_requested = true;
+
+    if (_scan_request_callback != nullptr) {
+        _scan_request_callback();
+    }
+    return true;
+}
+
+bool CustomWiFiManager::scanCached(const char *ssid, uint8_t channel) const {
+    return _scan_valid && millis() - _scan_published_at < _scan_ttl_ms
+           && _scan_published_channel == channel && strncmp(_scan_published_ssid, ssid, 32) == 0;
+}
+
+void CustomWiFiManager::setScanTTL(uint32_t ms) {
+    _scan_ttl_ms = ms;
+}
+
+void CustomWiFiManager::setScanRequestCallback(void (*func)()) {
+    _scan_request_callback = func;
+}
+
+bool CustomWiFiManager::scanRunning() const {
+    return _scan_running;
+}
+
+bool CustomWiFiManager::scanPending() const {
+    return _scan_running || _scan_requested;
+}
+
+void CustomWiFiManager::cancelScan() {
+    if (_scan_running) {
+        WiFi.scanDelete();
+    }
+    _scan_running = false;
+    _scan_requested = false;
+    _scan_reconnect = false;
+    // the connect task asks again if it still needs one
+    _connect_scan_requested = false;
+}
+
+void CustomWiFiManager::setScanCompleteCallback(void (*func)(int)) {
+    _scan_complete_callback = func;
+}
+
+void CustomWiFiManager::disconnect() {
+    disableWifi();
+    _connection_saved = false;
     // restart connection attempts
     connectionRetries = 0;
+    setConnectState(WIFI_STATE_START);
     // disable config portal connection attempts
     _config_portal_connect_retries = -1;
 }
 
+void CustomWiFiManager::resetSettings() {
+    WiFi.disconnect(true);
+    // forget the cached access point
+    boot_cache.record.wifi_channel = 0;
+    boot_cache.store();
+    // forget the saved networks
+    _credentials.count = 0;
+    storeCredentials();
+    disconnect();
+}
+
 
 void CustomWiFiManager::setMinimumSignalQuality(int quality) {
     _config_minimum_quality = quality;
@@ -243,15 +557,20 @@ bool CustomWiFiManager::connectWifi(const String *ssid, const String *pass) {
         disableWifi();
     }
 
+    _fast_connecting = false;
+    _connection_saved = false;
+
     //check if we have ssid and pass and force those, if not, try with last saved values
     if (ssid != nullptr) {
+        configureIP();
         if (pass != nullptr) {
             WiFi.begin(ssid->c_str(), pass->c_str()); // don't pass nullptr as pass or ssid
         } else {
             WiFi.begin(ssid->c_str());
         }
-    } else {
-        WiFi.begin();
+    } else if (_fast_connect_failed || !fastConnect()) {
+        configureIP();
+        beginSavedNetwork();
     }
 
     wl_status_t connectionStatus = WiFi.status();
@@ -262,6 +581,131 @@ bool CustomWiFiManager::connectWifi(const String *ssid, const String *pass) {
     return connection_ok;
 }
 
+void CustomWiFiManager::beginSavedNetwork() {
+    uint8_t credential;
+    int best = -1;
+    if (scanCached("", 0)) {
+        best = bestNetwork(scanResults(), -128, nullptr, &credential);
+    }
+
+    if (best >= 0) {
+        const WiFiResult &network = scanResults().networks[best];
+        const WiFiCredential &saved = _credentials.networks[credential];
+        WiFi.begin(saved.ssid, saved.password, network.channel, network.BSSID);
+    } else if (_credentials.count > 0) {
+        // not seen (hidden, or no scan), try the next one
+        const WiFiCredential &saved = _credentials.networks[connectionRetries % _credentials.count];
+        WiFi.begin(saved.ssid, saved.password);
+    } else {
+        // whatever the SDK has stored
+        WiFi.begin();
+    }
+}
+
+void CustomWiFiManager::addCredential(const char *ssid, const char *password) {
+    if (ssid == nullptr || ssid[0] == '\0') {
+        return;
+    }
+
+    WiFiCredential entry{};
+    strncpy(entry.ssid, ssid, sizeof(entry.ssid) - 1);
+    strncpy(entry.password, password, sizeof(entry.password) - 1);
+
+    // drop the old entry (or the oldest one) and insert at the front
+    uint8_t i = 0;
+    while (i < _credentials.count && strcmp(_credentials.networks[i].ssid, entry.ssid) != 0) {
+        i++;
+    }
+    if (i == _credentials.count && _credentials.count < WIFI_MANAGER_MAX_CREDENTIALS) {
+        _credentials.count++;
+    } else if (i == _credentials.count) {
+        i--;
+    }
+    memmove(&_credentials.networks[1], &_credentials.networks[0], i * sizeof(WiFiCredential));
+    _credentials.networks[0] = entry;
+
+    storeCredentials();
+}
+
+uint8_t CustomWiFiManager::credentialCount() const {
+    return _credentials.count;
+}
+
+void CustomWiFiManager::loadCredentials() {
+    EEPROM.begin(ESPY_EEPROM_SIZE);
+    EEPROM.get(WIFI_MANAGER_CREDENTIALS_EEPROM_OFFSET, _credentials);
+    EEPROM.end();
+
+    if (_credentials.magic != WIFI_MANAGER_CREDENTIALS_MAGIC
+        || _credentials.checksum != fnvHash((const uint8_t *) &_credentials.count,
+                                             sizeof(_credentials) - offsetof(WiFiCredentialStore, count))
+        || _credentials.count > WIFI_MANAGER_MAX_CREDENTIALS) {
+        memset(&_credentials, 0, sizeof(_credentials));
+    }
+}
+
+// flash is only written if the store changed
+void CustomWiFiManager::storeCredentials() {
+    _credentials.magic = WIFI_MANAGER_CREDENTIALS_MAGIC;
+    _credentials.checksum = fnvHash((const uint8_t *) &_credentials.count,
+                                     sizeof(_credentials) - offsetof(WiFiCredentialStore, count));
+
+    WiFiCredentialStore stored{};
+    EEPROM.begin(ESPY_EEPROM_SIZE);
+    EEPROM.get(WIFI_MANAGER_CREDENTIALS_EEPROM_OFFSET, stored);
+    if (memcmp(&stored, &_credentials, sizeof(_credentials)) != 0) {
+        EEPROM.put(WIFI_MANAGER_CREDENTIALS_EEPROM_OFFSET, _credentials);
+        EEPROM.commit();
+    }
+    EEPROM.end();
+}
+
+bool CustomWiFiManager::fastConnect() {
+    const boot_record &cached = boot_cache.record;
+    if (cached.wifi_channel == 0 || WiFi.SSID().length() == 0) {
+        return false;
+    }
+
+    // no channel scan. DHCP still runs, a lease from before the reset
+    // may have expired or been handed to another station.
+    configureIP();
+    WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str(), cached.wifi_channel, cached.wifi_bssid);
+    _fast_connecting = true;
+    return true;
+}
+
+void CustomWiFiManager::configureIP() {
+    if ((uint32_t) _static_ip != 0) {
+        WiFi.config(_static_ip, _static_gateway, _static_mask, _static_dns);
+    } else {
+        // DHCP
+        WiFi.config(IPAddress((uint32_t) 0), IPAddress((uint32_t) 0), IPAddress((uint32_t) 0));
+    }
+}
+
+void CustomWiFiManager::saveConnection() {
+    if (_connection_saved) {
+        return;
+    }
+    _connection_saved = true;
+    _fast_connecting = false;
+    _fast_connect_failed = false;
+
+    boot_record &cached = boot_cache.record;
+    cached.wifi_channel = WiFi.channel();
+    memcpy(cached.wifi_bssid, WiFi.BSSID(), sizeof(cached.wifi_bssid));
+
+    // RTC always, flash only if something changed
+    boot_cache.store();
+}
+
+void CustomWiFiManager::setStaticIP(IPAddress ip, IPAddress gateway, IPAddress mask, IPAddress dns) {
+    _static_ip = ip;
+    _static_gateway = gateway;
+    _static_mask = mask;
+    _static_dns = dns;
+}
+
 void CustomWiFiManager::disableWifi() {
 #if defined(ESP8266)
     // we might still be connecting, so that has to stop for scanning
@@ -273,152 +717,211 @@ void CustomWiFiManager::disableWifi() {
 #endif
 }
 
-void CustomWiFiManager::scan() {
-    wifi_ssid_count_t n = WiFi.scanNetworks();
+// called by the scan task when the scan completes
+void CustomWiFiManager::scanDone(int n) {
+    _scan_running = false;
 
-    if (n < 0) {
-        return; // error returned. Ignore, try again later.
-    }
-
-    // this whole code piece sucks. It works well enough and is almost never run. No point in cleaning.
+    if (n >= 0) {
+        if (n > WIFI_MANAGER_MAX_SCAN_RAW) {
+            n = WIFI_MANAGER_MAX_SCAN_RAW;
+        }
 
-    /* WE SHOULD MOVE THIS IN PLACE ATOMICALLY */
-    if (_config_portal_last_wifi_scan_networks) {
-        delete[] _config_portal_last_wifi_scan_networks;
-    }
+        // strongest first
+        uint8_t order[WIFI_MANAGER_MAX_SCAN_RAW];
+        for (int i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        std::sort(order, order + n, [](uint8_t a, uint8_t b) {
+            return WiFi.RSSI(a) > WiFi.RSSI(b);
+        });
 
-    _config_portal_last_wifi_scan_networks = new WiFiResult[n];
-    _config_portal_last_wifi_scan_count = n;
+        // fill the unpublished set, keeping the strongest entry per SSID
+        WiFiScanSet &set = _scan_sets[_scan_published ^ 1u];
+        set.count = 0;
+        uint16_t pool = 0;
 
-    for (wifi_ssid_count_t i = 0; i < n; i++) {
-        _config_portal_last_wifi_scan_networks[i].duplicate = false;
+        uint8_t table[WIFI_MANAGER_SCAN_HASH_SIZE];
+        uint32_t hashes[WIFI_MANAGER_MAX_SCAN_RESULTS];
+        memset(table, 0xff, sizeof(table));
 
-// TODO - check res to see whether the network is valid. Be smarter in adding those to the list.
+        for (int i = 0; i < n && set.count < WIFI_MANAGER_MAX_SCAN_RESULTS; i++) {
 #if defined(ESP8266)
-        WiFi.getNetworkInfo(i, _config_portal_last_wifi_scan_networks[i].SSID, _config_portal_last_wifi_scan_networks[i].encryptionType,
-                            _config_portal_last_wifi_scan_networks[i].RSSI, _config_portal_last_wifi_scan_networks[i].BSSID,
-                            _config_portal_last_wifi_scan_networks[i].channel, _config_portal_last_wifi_scan_networks[i].isHidden);
+            auto info = (const bss_info *) WiFi.getScanInfoByIndex(order[i]);
+            const uint8_t *ssid = info->ssid;
+            uint8_t length = info->ssid_len > 32 ? 32 : info->ssid_len;
 #else
-        WiFi.getNetworkInfo(i, wifiSSIDs[i].SSID, wifiSSIDs[i].encryptionType, wifiSSIDs[i].RSSI, wifiSSIDs[i].BSSID, wifiSSIDs[i].channel);
+            String name = WiFi.SSID(order[i]);
+            auto ssid = (const uint8_t *) name.c_str();
+            uint8_t length = name.length();
 #endif
-    }
-
+            uint32_t hash = fnvHash(ssid, length);
+
+            // open addressing, a hit with the same hash and SSID is a weaker duplicate
+            uint8_t slot = hash & (WIFI_MANAGER_SCAN_HASH_SIZE - 1u);
+            bool duplicate = false;
+            while (table[slot] != 0xff) {
+                uint8_t other = table[slot];
+                if (hashes[other] == hash && memcmp(set.ssid(other), ssid, length) == 0
+                    && set.ssid(other)[length] == '\0') {
+                    duplicate = true;
+                    break; // while
+                }
+                slot = (slot + 1) & (WIFI_MANAGER_SCAN_HASH_SIZE - 1u);
+            }
+            if (duplicate) {
+                continue; // for
+            }
+            if (pool + length + 1 > WIFI_MANAGER_SCAN_SSID_POOL) {
+                break; // for
+            }
 
-    // RSSI SORT
+            WiFiResult &result = set.networks[set.count];
+            result.ssidOffset = pool;
+            memcpy(set.ssids + pool, ssid, length);
+            set.ssids[pool + length] = '\0';
+            pool += length + 1;
+
+            result.RSSI = WiFi.RSSI(order[i]);
+            result.channel = WiFi.channel(order[i]);
+            result.encryptionType = WiFi.encryptionType(order[i]);
+            result.isHidden = WiFi.isHidden(order[i]);
+            memcpy(result.BSSID, WiFi.BSSID(order[i]), sizeof(result.BSSID));
+
+            hashes[set.count] = hash;
+            table[slot] = set.count;
+            set.count++;
+        }
 
-    // old sort
-    for (int i = 0; i < n; i++) {
-        for (int j = i + 1; j < n; j++) {
-            if (_config_portal_last_wifi_scan_networks[j].RSSI > _config_portal_last_wifi_scan_networks[i].RSSI) {
-                std::swap(_config_portal_last_wifi_scan_networks[i], _config_portal_last_wifi_scan_networks[j]);
+        // publish
+        memcpy(_scan_published_ssid, _scan_running_ssid, sizeof(_scan_published_ssid));
+        _scan_published_channel = _scan_running_channel;
+        _scan_published ^= 1u;
+        _scan_published_at = millis();
+        _scan_valid = true;
+    }
+    // else: error returned. Keep the last list, try again later.
+
+    WiFi.scanDelete();
+
+    // the scan stopped a connection attempt
+    if (_scan_reconnect) {
+        if (_config_portal_connect_retries > 0) {
+            // the portal waits for its own attempt
+            WiFi.begin();
+        } else if (_connect_state == WIFI_STATE_CONNECTING) {
+            // the connect task starts over with its own timeouts and backoff.
+            // In START it picks a network from the results, in BACKOFF its
+            // deadline starts the next attempt.
+            setConnectState(WIFI_STATE_START);
+            if (_connect_event_callback != nullptr) {
+                _connect_event_callback();
             }
         }
     }
+    _scan_reconnect = false;
 
-
-    // remove duplicates ( must be RSSI sorted )
-    String cssid;
-    for (int i = 0; i < n; i++) {
-        if (_config_portal_last_wifi_scan_networks[i].duplicate == true) continue;
-        cssid = _config_portal_last_wifi_scan_networks[i].SSID;
-        for (int j = i + 1; j < n; j++) {
-            if (cssid == _config_portal_last_wifi_scan_networks[j].SSID) {
-                _config_portal_last_wifi_scan_networks[j].duplicate = true; // set dup aps to NULL
-            }
-        }
+    if (_scan_complete_callback != nullptr) {
+        _scan_complete_callback(n);
     }
 }
 
+const WiFiScanSet &CustomWiFiManager::scanResults() const {
+    return _scan_sets[_scan_published];
+}
+
 void CustomWiFiManager::updateInfo() {
-    _cache_infoPage = infoAsHtml();
     _cache_wifiStatus = WiFi.status();
 }
 
 // ---------------------------------------- WEBSERVER STUFF
 
+// page layouts. Parts that do not apply to a request are repeated 0 times.
+static PGM_P const ROOT_PAGE[] PROGMEM = {
+        WFM_HTTP_HEAD, HTTP_SCRIPT, HTTP_STYLE, HTTP_HEAD_CUSTOM, HTTP_HEAD_END,
+        HTTP_PORTAL_TITLE, HTTP_PORTAL_OPTIONS, HTTP_OPTIONS_CUSTOM, HTTP_END
+};
+
+static PGM_P const WIFI_PAGE[] PROGMEM = {
+        WFM_HTTP_HEAD, HTTP_SCRIPT, HTTP_STYLE, HTTP_HEAD_CUSTOM, HTTP_SCAN_REFRESH, HTTP_HEAD_END,
+        HTTP_SCANNING, HTTP_NO_NETWORKS, HTTP_ITEM, HTTP_ITEMS_END,
+        HTTP_FORM_START, HTTP_FORM_PARAM, HTTP_FORM_PARAMS_END, HTTP_FORM_END, HTTP_SCAN_LINK, HTTP_END
+};
+
+static PGM_P const SAVED_PAGE[] PROGMEM = {
+        WFM_HTTP_HEAD, HTTP_SCRIPT, HTTP_STYLE, HTTP_HEAD_CUSTOM, HTTP_INFO_REFRESH, HTTP_HEAD_END,
+        HTTP_SAVED, HTTP_END
+};
+
+static PGM_P const INFO_PAGE[] PROGMEM = {
+        WFM_HTTP_HEAD, HTTP_SCRIPT, HTTP_STYLE, HTTP_HEAD_CUSTOM, HTTP_INFO_REFRESH, HTTP_HEAD_END,
+        HTTP_INFO_START, HTTP_INFO_CONNECTING, HTTP_INFO, HTTP_END
+};
+
+static PGM_P const RESET_PAGE[] PROGMEM = {
+        WFM_HTTP_HEAD, HTTP_SCRIPT, HTTP_STYLE, HTTP_HEAD_CUSTOM, HTTP_HEAD_END,
+        HTTP_RESET, HTTP_END
+};
+
+#define PAGE_PARTS(page) page, sizeof(page) / sizeof(page[0])
+
+std::shared_ptr<CustomWiFiManagerPage> CustomWiFiManager::portalPage(PGM_P const *parts, uint8_t count, const char *title) {
+    auto page = std::make_shared<CustomWiFiManagerPage>(parts, count);
+    page->title = title;
+    page->head = _config_custom_html_head;
+    return page;
+}
+
 /** Handle root or redirect to captive portal */
 void CustomWiFiManager::handleRoot(AsyncWebServerRequest *request) {
+    EspyActivity activity("http /");
+
     if (captivePortal(request)) { // If captive portal redirect instead of displaying the page.
         return;
     }
 
-    String page = FPSTR(WFM_HTTP_HEAD);
-    page.replace("{v}", "Options");
-    page += FPSTR(HTTP_SCRIPT);
-    page += FPSTR(HTTP_STYLE);
-    page += _config_custom_html_head;
-    page += FPSTR(HTTP_HEAD_END);
-    page += "<h1>";
-    page += _config_portal_ap_name;
-    page += "</h1>";
-    page += FPSTR(HTTP_PORTAL_OPTIONS);
-    page += _config_custom_html_options;
-    page += FPSTR(HTTP_END);
-
-    request->send(200, "text/html", page);
+    auto page = portalPage(PAGE_PARTS(ROOT_PAGE), "Options");
+    page->apName = _config_portal_ap_name;
+    page->options = _config_custom_html_options;
 
+    EspyTemplate::send(request, page);
 }
 
 /** Wifi config page handler */
 void CustomWiFiManager::handleWifi(AsyncWebServerRequest *request, boolean scan) {
-    String page = FPSTR(WFM_HTTP_HEAD);
-    page.replace("{v}", "Config ESP");
-    page += FPSTR(HTTP_SCRIPT);
-    page += FPSTR(HTTP_STYLE);
-    page += _config_custom_html_head;
-    page += FPSTR(HTTP_HEAD_END);
-
-    if (scan) {
-        if (_config_portal_last_wifi_scan_count == 0) {
-            page += F("No networks found. Refresh to scan again.");
-        } else {
-            //display networks in page
-            String result = networkListAsString();
-
-            page += result;
-            page += "<br/>";
-        }
-
+    EspyActivity activity("http /wifi");
+
+    // /wifi scans if the cached results are too old, /0wifi never does.
+    // ?s=<ssid> and ?c=<channel> limit the scan (hidden networks).
+    // A channel outside the band shows the cached results.
+    bool pending = _scan_running || _scan_requested;
+    long channel = request->arg("c").toInt();
+    if (scan && channel >= 0 && channel <= WIFI_MANAGER_MAX_CHANNEL) {
+        pending = requestScan(request->arg("s").c_str(), (uint8_t) channel);
     }
 
-    page += FPSTR(HTTP_FORM_START);
-    char parLength[3];
-    // add the extra parameters to the form
-    for (int i = 0; i < _custom_current_param_index; i++) {
-        if (_custom_config_parameters[i] == nullptr) {
-            break;
-        }
+    auto page = portalPage(PAGE_PARTS(WIFI_PAGE), "Config ESP");
+    page->scanPending = pending;
 
-        String pitem = FPSTR(HTTP_FORM_PARAM);
-        if (_custom_config_parameters[i]->getID() != nullptr) {
-            pitem.replace("{i}", _custom_config_parameters[i]->getID());
-            pitem.replace("{n}", _custom_config_parameters[i]->getID());
-            pitem.replace("{p}", _custom_config_parameters[i]->getPlaceholder());
-            snprintf(parLength, 2, "%d", _custom_config_parameters[i]->getValueLength());
-            pitem.replace("{l}", parLength);
-            pitem.replace("{v}", _custom_config_parameters[i]->getValue());
-            pitem.replace("{c}", _custom_config_parameters[i]->getCustomHTML());
-        } else {
-            pitem = _custom_config_parameters[i]->getCustomHTML();
-        }
-
-        page += pitem;
+    // strongest first, so the networks below the minimum quality are at the end
+    const WiFiScanSet &set = scanResults();
+    uint8_t shown = 0;
+    while (shown < set.count && qualityOk(set.networks[shown].RSSI)) {
+        shown++;
     }
-    if (_custom_config_parameters[0] != nullptr) {
-        page += "<br/>";
-    }
-
+    page->setNetworks(set, shown);
 
-    page += FPSTR(HTTP_FORM_END);
-    page += FPSTR(HTTP_SCAN_LINK);
-
-    page += FPSTR(HTTP_END);
+    page->params = _custom_config_parameters;
+    while (page->paramCount < _custom_current_param_index && _custom_config_parameters[page->paramCount] != nullptr) {
+        page->paramCount++;
+    }
 
-    request->send(200, "text/html", page);
+    EspyTemplate::send(request, page);
 }
 
 /** Handle the WLAN save form and redirect to WLAN config page again */
 void CustomWiFiManager::handleWifiSave(AsyncWebServerRequest *request) {
+    EspyActivity activity("http /wifisave");
+
 
     //SAVE/connect here
     _config_portal_ssid = request->arg("s").c_str();
@@ -435,58 +938,32 @@ void CustomWiFiManager::handleWifiSave(AsyncWebServerRequest *request) {
         value.toCharArray(_custom_config_parameters[i]->_value, _custom_config_parameters[i]->_length);
     }
 
-    String page = FPSTR(WFM_HTTP_HEAD);
-    page.replace("{v}", "Credentials Saved");
-    page += FPSTR(HTTP_SCRIPT);
-    page += FPSTR(HTTP_STYLE);
-    page += _config_custom_html_head;
-    page += F("<meta http-equiv=\"refresh\" content=\"5; url=/i\">");
-    page += FPSTR(HTTP_HEAD_END);
-    page += FPSTR(HTTP_SAVED);
-    page += FPSTR(HTTP_END);
+    auto page = portalPage(PAGE_PARTS(SAVED_PAGE), "Credentials Saved");
+    page->refresh = true;
 
-    request->send(200, "text/html", page);
+    EspyTemplate::send(request, page);
 
     // config stored, start connecting in the menu loop
     _config_portal_connect_retries = 0;
 }
 
 void CustomWiFiManager::handleInfo(AsyncWebServerRequest *request) {
-    String page = FPSTR(WFM_HTTP_HEAD);
-    page.replace("{v}", "Info");
-    page += FPSTR(HTTP_SCRIPT);
-    page += FPSTR(HTTP_STYLE);
-    page += _config_custom_html_head;
-    // add wifi status if the chip is trying to connect
-    if (_config_portal_connect_retries >= 0) {
-        page += F("<meta http-equiv=\"refresh\" content=\"5; url=/i\">");
-    }
-    page += FPSTR(HTTP_HEAD_END);
-    page += F("<dl>");
-
-    if (_config_portal_connect_retries >= 0) {
-        page += F("<dt>Trying to connect</dt><dd>");
-        page += _cache_wifiStatus;
-        page += F("</dd>");
-    }
+    EspyActivity activity("http /i");
 
-    page += _cache_infoPage;
-    page += FPSTR(HTTP_END);
+    auto page = portalPage(PAGE_PARTS(INFO_PAGE), "Info");
+    // add wifi status if the chip is trying to connect
+    page->connecting = _config_portal_connect_retries >= 0;
+    page->refresh = page->connecting;
+    page->status = _cache_wifiStatus;
 
-    request->send(200, "text/html", page);
+    EspyTemplate::send(request, page);
 }
 
 /** Handle the reset page */
 void CustomWiFiManager::handleReset(AsyncWebServerRequest *request) {
-    String page = FPSTR(WFM_HTTP_HEAD);
-    page.replace("{v}", "Info");
-    page += FPSTR(HTTP_SCRIPT);
-    page += FPSTR(HTTP_STYLE);
-    page += _config_custom_html_head;
-    page += FPSTR(HTTP_HEAD_END);
-    page += F("Module will reset in a few seconds.");
-    page += FPSTR(HTTP_END);
-    request->send(200, "text/html", page);
+    EspyActivity activity("http /r");
+
+    EspyTemplate::send(request, portalPage(PAGE_PARTS(RESET_PAGE), "Info"));
 
     delay(5000);
 #if defined(ESP8266)
@@ -498,6 +975,8 @@ void CustomWiFiManager::handleReset(AsyncWebServerRequest *request) {
 }
 
 void CustomWiFiManager::handleNotFound(AsyncWebServerRequest *request) {
+    EspyActivity activity("http notfound");
+
     if (captivePortal(request)) { // If captive portal redirect instead of displaying the error page.
         return;
     }
@@ -531,84 +1010,169 @@ boolean CustomWiFiManager::captivePortal(AsyncWebServerRequest *request) {
     return false;
 }
 
-// ---------------------------------------- HELPERS
+// ---------------------------------------- PAGES
 
+void CustomWiFiManagerPage::setNetworks(const WiFiScanSet &set, uint8_t count) {
+    scanFound = set.count > 0;
+    if (count == 0) {
+        return;
+    }
 
-/** Handle the info page */
-String CustomWiFiManager::infoAsHtml() {
-    String page;
-    page += F("<dt>Chip ID</dt><dd>");
+    uint16_t pool = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        pool += strlen(set.ssid(i)) + 1;
+    }
+    networkList.reset(new WiFiPageNetwork[count]);
+    ssids.reset(new char[pool]);
+
+    pool = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        const WiFiResult &network = set.networks[i];
+        WiFiPageNetwork &shown = networkList[i];
+        shown.ssidOffset = pool;
+        shown.quality = CustomWiFiManager::getRSSIasQuality(network.RSSI);
 #if defined(ESP8266)
-    page += ESP.getChipId();
+        shown.locked = network.encryptionType != ENC_TYPE_NONE;
 #else
-    page += getESP32ChipID();
+        shown.locked = network.encryptionType != WIFI_AUTH_OPEN;
 #endif
-    page += F("</dd>");
-    page += F("<dt>Flash Chip ID</dt><dd>");
+        size_t length = strlen(set.ssid(i)) + 1;
+        memcpy(ssids.get() + pool, set.ssid(i), length);
+        pool += length;
+    }
+    networks = count;
+}
+
+uint8_t CustomWiFiManagerPage::repeat(PGM_P part) {
+    if (part == HTTP_SCAN_REFRESH) {
+        return scanPending;
+    } else if (part == HTTP_SCANNING) {
+        return !scanFound && scanPending;
+    } else if (part == HTTP_NO_NETWORKS) {
+        return !scanFound && !scanPending;
+    } else if (part == HTTP_ITEM) {
+        return networks;
+    } else if (part == HTTP_ITEMS_END) {
+        return scanFound;
+    } else if (part == HTTP_FORM_PARAM) {
+        return paramCount;
+    } else if (part == HTTP_FORM_PARAMS_END) {
+        return paramCount > 0;
+    } else if (part == HTTP_INFO_REFRESH) {
+        return refresh;
+    } else if (part == HTTP_INFO_CONNECTING) {
+        return connecting;
+    }
+    return 1;
+}
+
+PGM_P CustomWiFiManagerPage::text(PGM_P part, uint8_t item) {
+    // parameters without an id are only custom html
+    if (part == HTTP_FORM_PARAM && params[item]->getID() == nullptr) {
+        return HTTP_FORM_CUSTOM;
+    }
+    return part;
+}
+
+const char *CustomWiFiManagerPage::value(PGM_P part, uint8_t item, char key) {
+    if (part == WFM_HTTP_HEAD && key == 'v') {
+        return title;
+    } else if (part == HTTP_HEAD_CUSTOM && key == 'h') {
+        return head;
+    } else if (part == HTTP_PORTAL_TITLE && key == 'a') {
+        return apName;
+    } else if (part == HTTP_OPTIONS_CUSTOM && key == 'o') {
+        return options;
+    } else if (part == HTTP_ITEM) {
+        const WiFiPageNetwork &network = networkList[item];
+        switch (key) {
+            case 'v':
+                return ssids.get() + network.ssidOffset;
+            case 'r':
+                snprintf_P(scratch, sizeof(scratch), PSTR("%d"), network.quality);
+                return scratch;
+            case 'i':
+                return network.locked ? "l" : "";
+            default:
+                return nullptr;
+        }
+    } else if (part == HTTP_FORM_PARAM) {
+        CustomWiFiManagerParameter *param = params[item];
+        switch (key) {
+            case 'i':
+            case 'n':
+                return param->getID();
+            case 'p':
+                return param->getPlaceholder();
+            case 'l':
+                snprintf_P(scratch, sizeof(scratch), PSTR("%d"), param->getValueLength());
+                return scratch;
+            case 'v':
+                return param->getValue();
+            case 'c':
+                return param->getCustomHTML();
+            default:
+                return nullptr;
+        }
+    } else if (part == HTTP_INFO_CONNECTING && key == 's') {
+        snprintf_P(scratch, sizeof(scratch), PSTR("%d"), (int) status);
+        return scratch;
+    } else if (part == HTTP_INFO) {
+        return infoValue(key);
+    }
+    return nullptr;
+}
+
+// formatted when the page gets to it, so the values are current
+const char *CustomWiFiManagerPage::infoValue(char key) {
+    switch (key) {
+        case 'c':
 #if defined(ESP8266)
-    page += ESP.getFlashChipId();
+            snprintf_P(scratch, sizeof(scratch), PSTR("%lu"), (unsigned long) ESP.getChipId());
 #else
-    page += F("N/A for ESP32");
+            strlcpy(scratch, getESP32ChipID().c_str(), sizeof(scratch));
 #endif
-    page += F("</dd>");
-    page += F("<dt>IDE Flash Size</dt><dd>");
-    page += ESP.getFlashChipSize();
-    page += F(" bytes</dd>");
-    page += F("<dt>Real Flash Size</dt><dd>");
+            break;
+        case 'f':
 #if defined(ESP8266)
-    page += ESP.getFlashChipRealSize();
+            snprintf_P(scratch, sizeof(scratch), PSTR("%lu"), (unsigned long) ESP.getFlashChipId());
 #else
-    page += F("N/A for ESP32");
+            return "N/A for ESP32";
 #endif
-    page += F(" bytes</dd>");
-    page += F("<dt>Soft AP IP</dt><dd>");
-    page += WiFi.softAPIP().toString();
-    page += F("</dd>");
-    page += F("<dt>Soft AP MAC</dt><dd>");
-    page += WiFi.softAPmacAddress();
-    page += F("</dd>");
-    page += F("<dt>Station SSID</dt><dd>");
-    page += WiFi.SSID();
-    page += F("</dd>");
-    page += F("<dt>Station IP</dt><dd>");
-    page += WiFi.localIP().toString();
-    page += F("</dd>");
-    page += F("<dt>Station MAC</dt><dd>");
-    page += WiFi.macAddress();
-    page += F("</dd>");
-    page += F("</dl>");
-    return page;
-}
-// ---------------------------------------- HELPERS
-
-
-String CustomWiFiManager::networkListAsString() {
-    String result;
-    //display networks in page
-    for (int i = 0; i < _config_portal_last_wifi_scan_count; i++) {
-        if (_config_portal_last_wifi_scan_networks[i].duplicate == true) continue; // skip dups
-        int quality = getRSSIasQuality(_config_portal_last_wifi_scan_networks[i].RSSI);
-
-        if (_config_minimum_quality == -1 || _config_minimum_quality < quality) {
-            String item = FPSTR(HTTP_ITEM);
-            item.replace("{v}", _config_portal_last_wifi_scan_networks[i].SSID);
-            item.replace("{r}", String(quality));
+            break;
+        case 'z':
+            snprintf_P(scratch, sizeof(scratch), PSTR("%lu"), (unsigned long) ESP.getFlashChipSize());
+            break;
+        case 'r':
 #if defined(ESP8266)
-            if (_config_portal_last_wifi_scan_networks[i].encryptionType != ENC_TYPE_NONE) {
+            snprintf_P(scratch, sizeof(scratch), PSTR("%lu"), (unsigned long) ESP.getFlashChipRealSize());
 #else
-                if (wifiSSIDs[i].encryptionType != WIFI_AUTH_OPEN) {
+            return "N/A for ESP32";
 #endif
-                item.replace("{i}", "l");
-            } else {
-                item.replace("{i}", "");
-            }
-            result += item;
-
-        }
+            break;
+        case 'a':
+            strlcpy(scratch, WiFi.softAPIP().toString().c_str(), sizeof(scratch));
+            break;
+        case 'm':
+            strlcpy(scratch, WiFi.softAPmacAddress().c_str(), sizeof(scratch));
+            break;
+        case 's':
+            strlcpy(scratch, WiFi.SSID().c_str(), sizeof(scratch));
+            break;
+        case 'i':
+            strlcpy(scratch, WiFi.localIP().toString().c_str(), sizeof(scratch));
+            break;
+        case 'n':
+            strlcpy(scratch, WiFi.macAddress().c_str(), sizeof(scratch));
+            break;
+        default:
+            return nullptr;
     }
-    return result;
+    return scratch;
 }
 
+// ---------------------------------------- HELPERS
+
 int CustomWiFiManager::getRSSIasQuality(const int RSSI) {
     int quality = 0;
 
@@ -0,0 +1,29 @@
+//
+// Boot time arena
+//
+
+#include <espy.h>
+
+void *EspyArena::allocate(size_t size, size_t align) {
+    size_t start = (_used + align - 1) & ~(align - 1);
+    if (start + size <= BOOT_ARENA_SIZE) {
+        _used = start + size;
+        return pool + start;
+    }
+
+    // too small, keep running on the heap
+    _overflow += size;
+    return malloc(size);
+}
+
+size_t EspyArena::used() const {
+    return _used;
+}
+
+size_t EspyArena::overflow() const {
+    return _overflow;
+}
+
+size_t EspyArena::capacity() {
+    return BOOT_ARENA_SIZE;
+}
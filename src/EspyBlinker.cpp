@@ -4,12 +4,13 @@
 
 #include <espy.h>
 
-EspyBlinker::EspyBlinker(int initial_in_ticks)
-        : state(false), initial(initial_in_ticks), counter(initial_in_ticks) {}
-
-void EspyBlinker::blink() {
-    if (--counter <= 0) {
-        state = !state;
-        counter = initial;
-    }
+EspyBlinker::EspyBlinker(uint32_t half_period_in_ms)
+        : half_period(half_period_in_ms) {}
+
+bool EspyBlinker::state(uint32_t now) const {
+    return ((now / half_period) & 1u) != 0;
+}
+
+uint32_t EspyBlinker::next_edge(uint32_t now) const {
+    return (now / half_period + 1) * half_period;
 }
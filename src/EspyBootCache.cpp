@@ -0,0 +1,55 @@
+//
+// Boot record in RTC memory and flash
+//
+
+#include <EEPROM.h>
+
+#include <espy.h>
+
+
+bool EspyBootCache::load() {
+    if (ESP.rtcUserMemoryRead(BOOT_CACHE_RTC_BLOCK, (uint32_t *) &record, sizeof(record)) && valid(record)) {
+        return true;
+    }
+
+    // RTC memory is random after a power cycle
+    EEPROM.begin(ESPY_EEPROM_SIZE);
+    EEPROM.get(BOOT_CACHE_EEPROM_OFFSET, record);
+    EEPROM.end();
+
+    if (valid(record)) {
+        return true;
+    }
+
+    memset(&record, 0, sizeof(record));
+    return false;
+}
+
+void EspyBootCache::store() {
+    record.magic = BOOT_CACHE_MAGIC;
+    record.checksum = checksum(record);
+    ESP.rtcUserMemoryWrite(BOOT_CACHE_RTC_BLOCK, (uint32_t *) &record, sizeof(record));
+
+    boot_record stored{};
+    EEPROM.begin(ESPY_EEPROM_SIZE);
+    EEPROM.get(BOOT_CACHE_EEPROM_OFFSET, stored);
+    if (memcmp(&stored, &record, sizeof(record)) != 0) {
+        EEPROM.put(BOOT_CACHE_EEPROM_OFFSET, record);
+        EEPROM.commit();
+    }
+    EEPROM.end();
+}
+
+// FNV-1a over everything after the checksum
+uint32_t EspyBootCache::checksum(const boot_record &r) {
+    auto data = (const uint8_t *) &r;
+    uint32_t hash = 2166136261u;
+    for (size_t i = offsetof(boot_record, checksum) + sizeof(r.checksum); i < sizeof(r); i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool EspyBootCache::valid(const boot_record &r) {
+    return r.magic == BOOT_CACHE_MAGIC && r.checksum == checksum(r);
+}
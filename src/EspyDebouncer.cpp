@@ -0,0 +1,60 @@
+/*
+ * Vertical counter debouncing.
+ */
+
+#include <espy.h>
+
+EspyDebouncer::EspyDebouncer(uint8_t ticks) {
+    set_threshold(0xffu, ticks);
+}
+
+void EspyDebouncer::set_threshold(uint8_t mask, uint8_t ticks) {
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > DEBOUNCE_MAX_TICKS) {
+        ticks = DEBOUNCE_MAX_TICKS;
+    }
+
+    for (uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+        if (ticks & bit(k)) {
+            threshold[k] |= mask;
+        } else {
+            threshold[k] &= ~mask;
+        }
+    }
+}
+
+uint8_t EspyDebouncer::update(uint8_t raw) {
+    uint8_t delta = raw ^ debounced;
+
+    // count up where the input differs from the debounced state, restart everywhere else
+    uint8_t carry = delta;
+    uint8_t mismatch = 0;
+    for (uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+        uint8_t next = counter[k] & carry;
+        counter[k] = (counter[k] ^ carry) & delta;
+        carry = next;
+        mismatch |= counter[k] ^ threshold[k];
+    }
+
+    // inputs that reached their threshold flip and restart their counter
+    uint8_t toggled = delta & ~mismatch;
+    debounced ^= toggled;
+    for (uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+        counter[k] &= ~toggled;
+    }
+
+    return toggled;
+}
+
+uint8_t EspyDebouncer::state() const {
+    return debounced;
+}
+
+bool EspyDebouncer::busy() const {
+    uint8_t any = 0;
+    for (uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+        any |= counter[k];
+    }
+    return any != 0;
+}
@@ -9,6 +9,7 @@ const char *LED_state_names[] = {".", "O", "I", "S", "F"};
 EspyDisplayBuffer::EspyDisplayBuffer(const char *name)
         : _name(name) {
     clear();
+    commit();
 };
 
 const char *EspyDisplayBuffer::name() {
@@ -21,71 +22,139 @@ void EspyDisplayBuffer::clear() {
         i[DISPLAY_COLS] = '\0';
     }
 
-    request_render();
+    for (auto &i : marquee) {
+        i[0] = '\0';
+    }
 }
 
-void EspyDisplayBuffer::lcd_print(int row, const char *fmt ...) {
-    va_list argp;
-    va_start(argp, fmt);
-    vsnprintf(text[row], DISPLAY_COLS, fmt, argp);
-    va_end(argp);
+void EspyDisplayBuffer::lcd_marquee(int row, const char *value) {
+    if (strlen(value) <= DISPLAY_COLS) {
+        lcd_row(row, value);
+        return;
+    }
 
-    request_render();
+    // a new text starts scrolling from the beginning
+    if (strncmp(marquee[row], value, LCD_MARQUEE_MAX) != 0) {
+        strncpy(marquee[row], value, LCD_MARQUEE_MAX);
+        marquee[row][LCD_MARQUEE_MAX] = '\0';
+        marquee_start = millis();
+    }
 }
 
-void EspyDisplayBuffer::lcd_print_P(int row, const char *fmt ...) {
-    va_list argp;
-    va_start(argp, fmt);
-    vsnprintf_P(text[row], DISPLAY_COLS, fmt, argp);
-    va_end(argp);
+void EspyDisplayBuffer::set_led(int n, led_state state) {
+    if (leds[n] != state) {
+        leds[n] = state;
+        wake();
+    }
+}
+
+void EspyDisplayBuffer::commit() {
+    memcpy(frame, text, sizeof(frame));
+    memcpy(frame_marquee, marquee, sizeof(frame_marquee));
+    frame_marquee_start = marquee_start;
 
-    request_render();
+    frame_scrolls = false;
+    for (auto &i : frame_marquee) {
+        frame_scrolls |= i[0] != '\0';
+    }
+
+    _generation++;
+    wake();
 }
 
-void EspyDisplayBuffer::request_render() {
-    render = true;
+uint32_t EspyDisplayBuffer::generation() const {
+    return _generation;
 }
 
-bool EspyDisplayBuffer::render_and_reset() {
-    bool res = render;
-    render = false;
-    return res;
+void EspyDisplayBuffer::wake() {
+    if (owner != nullptr) {
+        owner->wake();
+    }
 }
 
-EspyDisplay::EspyDisplay(EspyHardware &_hardware)
+EspyDisplay::EspyDisplay(EspyHardware &_hardware, void (*_wakeup)())
         : current(nullptr), hardware(_hardware),
-          fast(EspyBlinker(BLINK_FAST)), slow(EspyBlinker(BLINK_SLOW)) {
+          fast(EspyBlinker(BLINK_FAST_MS)), slow(EspyBlinker(BLINK_SLOW_MS)), wakeup(_wakeup) {
 }
 
-void EspyDisplay::refresh() {
-    fast.blink();
-    slow.blink();
+uint32_t EspyDisplay::refresh() {
+    uint32_t now = millis();
 
     if (current != nullptr) {
-        if (current->render_and_reset()) {
-            const char *buf[DISPLAY_ROWS];
+        // only complete frames are rendered, and only once per marquee step
+        uint32_t step = marquee_step(now);
+        if (current != rendered || current->generation() != rendered_generation || step != rendered_step) {
+            rendered = current;
+            rendered_generation = current->generation();
+            rendered_step = step;
+
+            lcd_frame frame{};
             for (int i = 0; i < DISPLAY_ROWS; i++) {
-                buf[i] = (char *) current->text[i];
+                frame.text[i] = current->frame[i];
+                frame.marquee[i] = current->frame_marquee[i][0] != '\0' ? current->frame_marquee[i] : nullptr;
             }
-            hardware.text(buf);
+            frame.step = step;
+            hardware.text(frame);
+        }
+
+        // LEDs must not be controlled by the frame generation, as
+        // they need to be rendered at every blink edge (otherwise they won't blink)
+        hardware.leds(compute_led_state(now));
+    }
+
+    return next_deadline(now) - now;
+}
+
+uint32_t EspyDisplay::next_deadline(uint32_t now) const {
+    uint32_t deadline = now + DISPLAY_MAX_SLEEP_MS;
+    if (current == nullptr) {
+        return deadline;
+    }
+
+    // committed while refreshing
+    if (current != rendered || current->generation() != rendered_generation) {
+        return now;
+    }
+
+    if (current->frame_scrolls) {
+        uint32_t edge = current->frame_marquee_start + (marquee_step(now) + 1) * MARQUEE_STEP_MS;
+        if ((int32_t) (edge - deadline) < 0) {
+            deadline = edge;
+        }
+    }
+
+    for (auto state : current->leds) {
+        uint32_t edge = deadline;
+        if (state == SLOW) {
+            edge = slow.next_edge(now);
+        } else if (state == FAST) {
+            edge = fast.next_edge(now);
+        }
+
+        if ((int32_t) (edge - deadline) < 0) {
+            deadline = edge;
         }
+    }
+    return deadline;
+}
 
-        // LEDs must not be controlled by the "render and reset" flag, as
-        // they need to be contiuously rendered (otherwise they won't blink)
-        hardware.leds(compute_led_state());
+uint32_t EspyDisplay::marquee_step(uint32_t now) const {
+    if (current == nullptr || !current->frame_scrolls) {
+        return 0;
     }
+    return (now - current->frame_marquee_start) / MARQUEE_STEP_MS;
 }
 
-uint8_t EspyDisplay::compute_led_state() const {
+uint8_t EspyDisplay::compute_led_state(uint32_t now) const {
 
     uint8_t led = 0x1fu;
     for (unsigned int i = 0; i < 5; i++) {
 
         led_state state = current->leds[i];
         if (state == SLOW) {
-            state = slow.state ? led_state::ON : led_state::OFF;
+            state = slow.state(now) ? led_state::ON : led_state::OFF;
         } else if (state == FAST) {
-            state = fast.state ? led_state::ON : led_state::OFF;
+            state = fast.state(now) ? led_state::ON : led_state::OFF;
         }
 
         if (state == ON) {
@@ -98,8 +167,68 @@ uint8_t EspyDisplay::compute_led_state() const {
 }
 
 void EspyDisplay::display(EspyDisplayBuffer *buf) {
+    if (current != nullptr) {
+        current->owner = nullptr;
+    }
+
     current = buf;
     if (current != nullptr) {
-        current->request_render();
+        current->owner = this;
+        wake();
+    }
+}
+
+void EspyDisplay::redraw() {
+    rendered = nullptr;
+    wake();
+}
+
+void EspyDisplay::wake() {
+    if (wakeup != nullptr) {
+        wakeup();
+    }
+}
+
+char EspyDisplay::glyph(uint8_t id) {
+    if (hardware.lcd == nullptr) {
+        return EspyGlyphCache::fallback(id);
+    }
+    return hardware.lcd->glyphs.get(id, pinned_glyphs());
+}
+
+char EspyDisplay::glyph(uint8_t id, const uint8_t *bitmap) {
+    if (hardware.lcd == nullptr) {
+        return '?';
+    }
+    return hardware.lcd->glyphs.get(id, bitmap, pinned_glyphs());
+}
+
+void EspyDisplay::bar(char *cells, uint8_t width, uint32_t value, uint32_t max) {
+    uint32_t columns = 0;
+    if (max > 0) {
+        columns = (uint32_t) ((uint64_t) std::min(value, max) * width * GLYPH_BAR_COLUMNS / max);
+    }
+
+    for (uint8_t i = 0; i < width; i++) {
+        if (columns >= GLYPH_BAR_COLUMNS) {
+            cells[i] = (char) 0xff; // full block in the character ROM
+            columns -= GLYPH_BAR_COLUMNS;
+        } else if (columns > 0) {
+            cells[i] = glyph(GLYPH_BAR_1 + columns - 1);
+            columns = 0;
+        } else {
+            cells[i] = ' ';
+        }
+    }
+    cells[width] = '\0';
+}
+
+// slots shown by the last committed frame, they must not be reloaded
+uint8_t EspyDisplay::pinned_glyphs() const {
+    uint8_t pinned = 0;
+    if (current != nullptr) {
+        pinned |= EspyGlyphCache::slots_used(&current->frame[0][0], sizeof(current->frame));
+        pinned |= EspyGlyphCache::slots_used(&current->frame_marquee[0][0], sizeof(current->frame_marquee));
     }
+    return pinned;
 }
@@ -0,0 +1,93 @@
+/*
+ * Fixed width row formatting.
+ */
+
+#include <espy.h>
+
+EspyRowWriter::EspyRowWriter(char *_row, uint8_t width)
+        : row(_row), pos(_row), end(_row + width) {
+}
+
+void EspyRowWriter::put(char c) {
+    if (pos < end) {
+        *pos++ = c;
+    }
+}
+
+void EspyRowWriter::put(const char *s) {
+    if (s != nullptr) {
+        while (*s != '\0' && pos < end) {
+            *pos++ = *s++;
+        }
+    }
+}
+
+void EspyRowWriter::put(const __FlashStringHelper *s) {
+    auto p = reinterpret_cast<PGM_P>(s);
+    if (p != nullptr) {
+        char c;
+        while ((c = (char) pgm_read_byte(p++)) != '\0' && pos < end) {
+            *pos++ = c;
+        }
+    }
+}
+
+void EspyRowWriter::put(const String &s) {
+    put(s.c_str());
+}
+
+void EspyRowWriter::put(int value) {
+    put((long) value);
+}
+
+void EspyRowWriter::put(unsigned int value) {
+    put((unsigned long) value);
+}
+
+void EspyRowWriter::put(long value) {
+    if (value < 0) {
+        put('-');
+        put(0ul - (unsigned long) value);
+    } else {
+        put((unsigned long) value);
+    }
+}
+
+void EspyRowWriter::put(unsigned long value) {
+    char digits[10];
+    uint8_t count = 0;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (count > 0) {
+        put(digits[--count]);
+    }
+}
+
+void EspyRowWriter::put(const IPAddress &ip) {
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) {
+            put('.');
+        }
+        put((unsigned int) ip[i]);
+    }
+}
+
+uint8_t EspyRowWriter::length() const {
+    return pos - row;
+}
+
+void EspyRowWriter::fill() {
+    while (pos < end) {
+        *pos++ = ' ';
+    }
+    *pos = '\0';
+}
+
+void EspyRowWriter::pad(int count) {
+    while (count-- > 0) {
+        put(' ');
+    }
+}
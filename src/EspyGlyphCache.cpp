@@ -0,0 +1,114 @@
+/*
+ * CGRAM glyph cache.
+ */
+
+#include <espy.h>
+
+// slots never loaded have this id
+#define GLYPH_NONE 0xffu
+
+struct glyph_definition {
+    uint8_t bitmap[GLYPH_ROWS];
+    char fallback;
+};
+
+static const glyph_definition builtin_glyphs[GLYPH_BUILTIN_COUNT] PROGMEM = {
+        {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x15}, '0'}, // GLYPH_SIGNAL_0
+        {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x15}, '1'}, // GLYPH_SIGNAL_1
+        {{0x00, 0x00, 0x00, 0x04, 0x04, 0x04, 0x14, 0x15}, '2'}, // GLYPH_SIGNAL_2
+        {{0x01, 0x01, 0x01, 0x05, 0x05, 0x05, 0x15, 0x15}, '3'}, // GLYPH_SIGNAL_3
+        {{0x00, 0x0e, 0x11, 0x11, 0x11, 0x0e, 0x00, 0x00}, '.'}, // GLYPH_LED_OFF
+        {{0x00, 0x0e, 0x1f, 0x1f, 0x1f, 0x0e, 0x00, 0x00}, 'O'}, // GLYPH_LED_ON
+        {{0x00, 0x0e, 0x11, 0x1f, 0x11, 0x0e, 0x00, 0x00}, 'I'}, // GLYPH_LED_IGNORE
+        {{0x00, 0x0e, 0x11, 0x1f, 0x1f, 0x0e, 0x00, 0x00}, 'S'}, // GLYPH_LED_SLOW
+        {{0x00, 0x0e, 0x11, 0x15, 0x11, 0x0e, 0x00, 0x00}, 'F'}, // GLYPH_LED_FAST
+        {{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10}, '|'}, // GLYPH_BAR_1
+        {{0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18}, '|'}, // GLYPH_BAR_2
+        {{0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c}, '|'}, // GLYPH_BAR_3
+        {{0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e}, '|'}, // GLYPH_BAR_4
+};
+
+EspyGlyphCache::EspyGlyphCache() {
+    for (auto &slot : slots) {
+        slot.id = GLYPH_NONE;
+    }
+}
+
+char EspyGlyphCache::get(uint8_t id, uint8_t pinned) {
+    if (id >= GLYPH_BUILTIN_COUNT) {
+        return '?';
+    }
+
+    uint8_t bitmap[GLYPH_ROWS];
+    memcpy_P(bitmap, builtin_glyphs[id].bitmap, GLYPH_ROWS);
+    return get(id, bitmap, pinned);
+}
+
+char EspyGlyphCache::get(uint8_t id, const uint8_t *bitmap, uint8_t pinned) {
+    uint8_t index = find(id, pinned);
+    if (index == GLYPH_SLOTS) {
+        // everything is on screen
+        return fallback(id);
+    }
+    glyph_slot &slot = slots[index];
+
+    if (slot.id != id || memcmp(slot.bitmap, bitmap, GLYPH_ROWS) != 0) {
+        slot.id = id;
+        memcpy(slot.bitmap, bitmap, GLYPH_ROWS);
+        slot.dirty = true;
+    }
+
+    slot.last_used = ++clock;
+    return (char) (GLYPH_CHAR_BASE + index);
+}
+
+char EspyGlyphCache::fallback(uint8_t id) {
+    if (id >= GLYPH_BUILTIN_COUNT) {
+        return '?';
+    }
+    return (char) pgm_read_byte(&builtin_glyphs[id].fallback);
+}
+
+uint8_t EspyGlyphCache::slots_used(const char *text, size_t length) {
+    uint8_t used = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = text[i];
+        if (c >= GLYPH_CHAR_BASE && c < GLYPH_CHAR_BASE + GLYPH_SLOTS) {
+            used |= 1u << (c - GLYPH_CHAR_BASE);
+        }
+    }
+    return used;
+}
+
+// slot holding the id, or the least recently used slot that is not pinned.
+// GLYPH_SLOTS if all are pinned.
+uint8_t EspyGlyphCache::find(uint8_t id, uint8_t pinned) {
+    uint8_t lru = GLYPH_SLOTS;
+    for (uint8_t i = 0; i < GLYPH_SLOTS; i++) {
+        if (slots[i].id == id) {
+            return i;
+        }
+        if (!(pinned & (1u << i)) && (lru == GLYPH_SLOTS || slots[i].last_used < slots[lru].last_used)) {
+            lru = i;
+        }
+    }
+    return lru;
+}
+
+void EspyGlyphCache::invalidate() {
+    for (auto &slot : slots) {
+        slot.dirty = true;
+    }
+}
+
+void EspyGlyphCache::upload(EspyLcdBus &bus) {
+    for (uint8_t i = 0; i < GLYPH_SLOTS; i++) {
+        if (slots[i].dirty) {
+            bus.command(LCD_SETCGRAMADDR | (i << 3u));
+            for (uint8_t row = 0; row < GLYPH_ROWS; row++) {
+                bus.write(slots[i].bitmap[row]);
+            }
+            slots[i].dirty = false;
+        }
+    }
+}
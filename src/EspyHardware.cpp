@@ -5,11 +5,8 @@
 #include <espy.h>
 
 
-#define MAX_I2C_DEV_DETECTED 8
-
-
 EspyHardware::EspyHardware()
-        : display_address(0xff), pcf_address(0xff), error(HW_NO_ERROR), pcf(nullptr), display(nullptr) {
+        : display_address(0xff), pcf_address(0xff), error(HW_NO_ERROR), port(nullptr), display(nullptr), lcd_bus(nullptr), lcd(nullptr) {
 
     _init_i2c_bus();
 
@@ -20,78 +17,144 @@ EspyHardware::EspyHardware()
     }
 }
 
+// the panel may have missed writes, draw it from scratch
+static void lcd_recovered() {
+    if (hardware != nullptr && hardware->lcd != nullptr) {
+        hardware->lcd->invalidate();
+        if (display != nullptr) {
+            display->redraw();
+        }
+    }
+}
+
+// keep the character padding in step with the bus clock. The clock only
+// changes after errors, so the panel is redrawn as well.
+static void lcd_clock_changed(uint32_t hz) {
+    if (hardware != nullptr && hardware->lcd_bus != nullptr) {
+        hardware->lcd_bus->set_clock(hz);
+    }
+    lcd_recovered();
+}
+
+// stop the frame clock when the last transaction of a frame is on the bus
+static void lcd_transaction_sent(uint32_t count) {
+    if (hardware != nullptr && hardware->lcd_bus != nullptr) {
+        hardware->lcd_bus->sent(count);
+    }
+}
+
 void EspyHardware::init_display() {
-    display = new LiquidCrystal_I2C(display_address, DISPLAY_COLS, DISPLAY_ROWS);
+    display = boot_arena.make<LiquidCrystal_I2C>(display_address, DISPLAY_COLS, DISPLAY_ROWS);
     display->init();
+    // init restarts Wire at its default clock
+    Wire.setClock(i2c.clock);
     display->clear();
     display->backlight();
     display->cursor_off();
+    lcd_bus = boot_arena.make<EspyLcdBus>(*display, display_address);
+    lcd_bus->set_clock(i2c.clock);
+    i2c.clock_changed = lcd_clock_changed;
+    i2c.recovered = lcd_recovered;
+    i2c.transaction_sent = lcd_transaction_sent;
+    lcd = boot_arena.make<EspyLcd>(*lcd_bus);
 }
 
 void EspyHardware::init_pcf() {
-    pcf = new PCF8574(pcf_address);
-    pcf->begin();
+    port = boot_arena.make<EspyPort>(pcf_address);
+    port->begin();
 }
 
 void EspyHardware::leds(uint8_t led_value) const {
-    if (pcf != nullptr) {
-        pcf->write8(BUTTON_IO_MASK | ~(led_value & LED_IO_MASK));
+    if (port != nullptr) {
+        // button pins must stay high to be read as inputs
+        port->output(BUTTON_IO_MASK | ~(led_value & LED_IO_MASK));
+        if (!key_scan_active) {
+            port->flush();
+        }
     }
 }
 
 uint8_t EspyHardware::keys() const {
-    if (pcf != nullptr) {
-        return ((~pcf->readButton8(BUTTON_IO_MASK)) & BUTTON_IO_MASK) >> BUTTON_SHIFT;
+    if (port != nullptr) {
+        port->sync();
+        return ((~port->input()) & BUTTON_IO_MASK) >> BUTTON_SHIFT;
     } else {
         return 0;
     }
 }
 
-void EspyHardware::text(const char *text[DISPLAY_ROWS]) const {
-    if (display != nullptr) {
-        display->clear();
-        for (int i = 0; i < DISPLAY_ROWS; i++) {
-            display->setCursor(0, i);
-            display->print(text[i]);
-        }
+void EspyHardware::text(const lcd_frame &frame) const {
+    if (lcd != nullptr) {
+        lcd->render(frame);
     }
 }
 
 void EspyHardware::_init_i2c_bus() {
-    uint8_t i2c_address[MAX_I2C_DEV_DETECTED];
-    int i2c_address_ptr = 0;
-
     // Start I2C Bus
-    Wire.begin(I2C_SDA, I2C_SCL);
-
-    // scan bus for devices
-    for (uint8_t address = 1; address < 127; address++) {
-        // The i2c_scanner uses the return value of
-        // the Write.endTransmission to see if
-        // a device did acknowledge to the address.
-        Wire.beginTransmission(address);
-
-        uint8_t wire_error = Wire.endTransmission();
-        if (wire_error == 0) {
-            i2c_address[i2c_address_ptr++] = address;
-            if (i2c_address_ptr == MAX_I2C_DEV_DETECTED) {
-                break; // for
-            }
-        } else {
-            Wire.clearWriteError();
+    i2c.begin(I2C_SDA, I2C_SCL);
+
+    // a warm boot only has to confirm the devices from last time
+    if (boot_cache.load()
+        && EspyI2c::probe(boot_cache.record.pcf_address)
+        && EspyI2c::probe(boot_cache.record.display_address)) {
+        pcf_address = boot_cache.record.pcf_address;
+        display_address = boot_cache.record.display_address;
+    } else {
+        // ascending, so the roles are assigned as before: the lowest
+        // address with the low bits clear is the PCF, the lowest other
+        // one the display. Stops once both are found.
+        scan(1, 126);
+
+        if (pcf_address != 0xff && display_address != 0xff) {
+            boot_cache.record.pcf_address = pcf_address;
+            boot_cache.record.display_address = display_address;
+            boot_cache.store();
         }
     }
 
-    // look at the devices found
-    for (int i = 0; i < i2c_address_ptr; i++) {
-        if ((pcf_address == 0xff) && ((i2c_address[i] & ((uint8_t) 0x7)) == 0)) {
+    // stay in fast mode only if every device reads back what was written
+    while (!self_test() && i2c.step_down()) {
+    }
+
+    if (pcf_address != 0xff) {
+        init_pcf();
+    }
+    if (display_address != 0xff) {
+        init_display();
+    }
+}
+
+// scan an address range until both devices are known
+void EspyHardware::scan(uint8_t first, uint8_t last) {
+    for (uint8_t address = first; address <= last; address++) {
+        if (pcf_address != 0xff && display_address != 0xff) {
+            return;
+        }
+        if (address == pcf_address || address == display_address || !EspyI2c::probe(address)) {
+            continue; // for
+        }
+
+        if ((pcf_address == 0xff) && ((address & ((uint8_t) 0x7)) == 0)) {
             // all lower bits are 0. claim the first match as the
             // PCF chip
-            pcf_address = i2c_address[i];
-            init_pcf();
+            pcf_address = address;
         } else if (display_address == 0xff) {
-            display_address = i2c_address[i];
-            init_display();
+            display_address = address;
         }
     }
-};
+}
+
+// read back test of the port expanders at the current clock
+bool EspyHardware::self_test() const {
+    bool ok = true;
+    if (pcf_address != 0xff) {
+        // button pins read the buttons, not the written value
+        ok &= i2c.self_test(pcf_address, LED_IO_MASK, 0xff);
+    }
+    if (display_address != 0xff) {
+        // never strobe the controller or switch it to read mode. The backlight
+        // pin drives a transistor base and reads back low.
+        ok &= i2c.self_test(display_address, 0xff & ~(En | Rw | LCD_BACKLIGHT), LCD_BACKLIGHT);
+    }
+    return ok;
+}
@@ -0,0 +1,228 @@
+//
+// I2C bus manager
+//
+
+#include <espy.h>
+
+static const uint32_t i2c_clocks[I2C_CLOCK_COUNT] = I2C_CLOCKS;
+
+// read back patterns for the self test
+static const uint8_t i2c_test_patterns[] = {0xa5, 0x5a};
+
+void EspyI2c::begin(uint8_t _sda, uint8_t _scl) {
+    sda = _sda;
+    scl = _scl;
+
+    recover();
+    Wire.begin(sda, scl);
+    set_clock(0);
+}
+
+bool EspyI2c::probe(uint8_t address) {
+    Wire.beginTransmission(address);
+
+    if (Wire.endTransmission() == I2C_OK) {
+        return true;
+    }
+    Wire.clearWriteError();
+    return false;
+}
+
+bool EspyI2c::self_test(uint8_t address, uint8_t mask, uint8_t restore) {
+    bool ok = true;
+    for (auto pattern : i2c_test_patterns) {
+        uint8_t value = (pattern & mask) | (restore & ~mask);
+        Wire.beginTransmission(address);
+        Wire.write(value);
+        if (end_transmission(address, false) != I2C_OK || request(address, 1) != 1) {
+            ok = false;
+            break; // for
+        }
+        if ((Wire.read() & mask) != (value & mask)) {
+            // the device answered but the data is corrupt
+            device(address).mismatches++;
+            ok = false;
+            break; // for
+        }
+    }
+
+    Wire.beginTransmission(address);
+    Wire.write(restore);
+    end_transmission(address);
+
+    return ok;
+}
+
+uint8_t EspyI2c::end_transmission(uint8_t address, bool stop) {
+    uint8_t result = Wire.endTransmission(stop);
+    account(address, result);
+    return result;
+}
+
+uint8_t EspyI2c::request(uint8_t address, uint8_t count) {
+    uint8_t received = Wire.requestFrom(address, count);
+    account(address, received == count ? I2C_OK : I2C_BUS_ERROR);
+    return received;
+}
+
+void EspyI2c::submit(uint8_t address, const uint8_t *data, uint8_t length) {
+    i2c_transaction transaction;
+    transaction.address = address;
+    transaction.length = length;
+    memcpy(transaction.data, data, length);
+
+    if (!queue.push(transaction)) {
+        queue_stalls++;
+        run(0);
+        queue.push(transaction);
+    }
+    submitted++;
+
+    if (queue_wakeup != nullptr) {
+        queue_wakeup();
+    }
+}
+
+bool EspyI2c::run(uint32_t budget_us) {
+    uint32_t start = micros();
+    i2c_transaction transaction;
+
+    do {
+        if (!queue.pop(transaction)) {
+            return false;
+        }
+        send(transaction);
+    } while (micros() - start < budget_us);
+
+    return queue.size() > 0;
+}
+
+void EspyI2c::send(const i2c_transaction &transaction) {
+    Wire.beginTransmission(transaction.address);
+    Wire.write(transaction.data, transaction.length);
+    end_transmission(transaction.address);
+
+    sent++;
+    if (transaction_sent != nullptr) {
+        transaction_sent(sent);
+    }
+}
+
+bool EspyI2c::step_down() {
+    if (clock_index + 1 >= I2C_CLOCK_COUNT) {
+        return false;
+    }
+    set_clock(clock_index + 1);
+    return true;
+}
+
+void EspyI2c::recover() {
+    pinMode(sda, INPUT_PULLUP);
+    if (digitalRead(sda) == HIGH) {
+        return;
+    }
+
+    recoveries++;
+
+    // a slave in the middle of a read holds SDA low until it has
+    // clocked out the rest of its byte
+    pinMode(scl, OUTPUT_OPEN_DRAIN);
+    for (uint8_t i = 0; i < I2C_RECOVERY_CLOCKS && digitalRead(sda) == LOW; i++) {
+        digitalWrite(scl, LOW);
+        delayMicroseconds(5);
+        digitalWrite(scl, HIGH);
+        delayMicroseconds(5);
+    }
+
+    // stop condition: SDA rises while SCL is high
+    pinMode(sda, OUTPUT_OPEN_DRAIN);
+    digitalWrite(sda, LOW);
+    delayMicroseconds(5);
+    digitalWrite(scl, HIGH);
+    delayMicroseconds(5);
+    digitalWrite(sda, HIGH);
+    delayMicroseconds(5);
+}
+
+const i2c_device_stats *EspyI2c::stats(uint8_t address) const {
+    for (auto &d : devices) {
+        if (d.address == address) {
+            return &d;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t EspyI2c::total_nacks() const {
+    uint32_t total = 0;
+    for (auto &d : devices) {
+        total += d.nacks;
+    }
+    return total;
+}
+
+uint32_t EspyI2c::total_timeouts() const {
+    uint32_t total = 0;
+    for (auto &d : devices) {
+        total += d.timeouts;
+    }
+    return total;
+}
+
+// counters for the address. Devices beyond the table share the last entry.
+i2c_device_stats &EspyI2c::device(uint8_t address) {
+    for (auto &d : devices) {
+        if (d.address == address || d.address == 0xff) {
+            d.address = address;
+            return d;
+        }
+    }
+    return devices[I2C_MAX_DEVICES - 1];
+}
+
+void EspyI2c::set_clock(uint8_t index) {
+    clock_index = index;
+    clock = i2c_clocks[index];
+    for (auto &d : devices) {
+        d.errors = 0;
+    }
+    Wire.setClock(clock);
+
+    if (clock_changed != nullptr) {
+        clock_changed(clock);
+    }
+}
+
+void EspyI2c::account(uint8_t address, uint8_t result) {
+    i2c_device_stats &d = device(address);
+    d.transactions++;
+
+    if (result == I2C_OK) {
+        d.errors = 0;
+        return;
+    }
+
+    if (result == I2C_ADDRESS_NACK) {
+        // the device is absent, that says nothing about the bus
+        d.nacks++;
+        return;
+    }
+
+    if (result == I2C_DATA_NACK) {
+        d.nacks++;
+    } else {
+        d.timeouts++;
+        // the bus may be stuck in the middle of a byte
+        recover();
+        Wire.begin(sda, scl);
+        Wire.setClock(clock);
+        if (recovered != nullptr) {
+            recovered();
+        }
+    }
+
+    // only the device that keeps failing counts
+    if (++d.errors >= I2C_ERROR_LIMIT) {
+        step_down();
+    }
+}
@@ -4,59 +4,135 @@
 
 #include <espy.h>
 
-EspyKeys::EspyKeys(EspyHardware &_hardware)
-        : hardware(_hardware) {
+volatile bool EspyKeys::pending = true; // always scan once at startup
+
+EspyKeys::EspyKeys(EspyHardware &_hardware, int8_t _int_pin)
+        : hardware(_hardware), debouncer(EspyDebouncer(DEBOUNCE_TIME_MS / KEY_TIMER_MS)), int_pin(_int_pin) {
+    if (int_pin >= 0) {
+        // INT is open drain, active low and released by reading the port
+        pinMode(int_pin, INPUT_PULLUP);
+        attachInterrupt(digitalPinToInterrupt(int_pin), on_interrupt, FALLING);
+    }
+}
+
+void IRAM_ATTR EspyKeys::on_interrupt() {
+    pending = true;
+}
+
+bool EspyKeys::wakeup() {
+    return pending;
 }
 
 extern uint8_t debug_keys;
 
-void EspyKeys::scan() {
-    uint8_t key_state = hardware.keys();
+// keys are in the wrong order, so 1 2 4 --> 4 2 1
+static inline uint8_t key_bit(uint8_t key) {
+    return 4u >> key;
+}
+
+bool EspyKeys::scan(uint32_t late_ms) {
+    // clear before reading, a change after the read raises it again
+    pending = false;
 
-    for (unsigned int i = 0; i < 3; i++) {
-        uint8_t bit = 4u >> i; // keys are in the wrong order, so 1 2 4 --> 4 2 1
+    uint8_t raw = hardware.keys();
+    debouncer.update(raw);
+    uint8_t key_state = debouncer.state();
+
+    // a key is still down or a change is being debounced
+    bool active = (raw | key_state) != 0 || debouncer.busy();
+    uint32_t now = millis();
+    uint32_t due = now - late_ms;
+
+    for (uint8_t i = 0; i < KEY_COUNT; i++) {
         key_control *control = &keys[i];
-        if (key_state & bit) {
+        const key_profile &profile = control->profile;
+
+        // the first scan that sees a change starts the latency clock
+        bool bouncing = ((raw ^ key_state) & key_bit(i)) != 0;
+        if (bouncing && !control->bouncing) {
+            control->edge_time = due;
+        }
+        control->bouncing = bouncing;
+
+        // no second press in time, the held back click was a single click
+        bool click_pending = control->clicked && profile.double_click_ms > 0;
+        if (click_pending && (now - control->release_time) > profile.double_click_ms) {
+            if (!emit(i, KEY_RELEASE, control->release_time + profile.double_click_ms)) {
+                continue; // for, retry at the next scan
+            }
+            control->clicked = false;
+            click_pending = false;
+        }
+
+        if (key_state & key_bit(i)) {
             // key pressed
-            control->release_count = 0;
-            if (++control->press_count > (DEBOUNCE_TIME_MS / KEY_TIMER_MS)) {
-                if (!control->pressed) {
-                    control->pressed = true;
-                    if (control->on_press != nullptr) {
-                        control->on_press();
-                    }
+            if (!control->pressed) {
+                bool double_click = click_pending;
+                if (!emit(i, double_click ? KEY_DOUBLE_CLICK : KEY_PRESS, control->edge_time)) {
+                    continue; // for, retry at the next scan
                 }
+                control->pressed = true;
+                control->consumed = double_click;
+                control->clicked = false;
+                control->press_time = now;
+                control->next_repeat = now + profile.repeat_delay_ms;
+            }
 
-                if (control->press_count > (LONG_PRESS_TIME_MS / KEY_TIMER_MS)) {
-                    if (!control->long_pressed) {
-                        control->long_pressed = true;
-                        if (control->on_long_press != nullptr) {
-                            control->on_long_press();
-                        }
-                    }
+            if (profile.long_press_ms > 0 && !control->long_pressed
+                && (now - control->press_time) >= profile.long_press_ms) {
+                if (emit(i, KEY_LONG_PRESS, due)) {
+                    control->long_pressed = true;
+                    control->consumed = true;
                 }
             }
-        } else {
-            // key released
-            control->press_count = 0;
-            if (control->pressed && (++control->release_count > (DEBOUNCE_TIME_MS / KEY_TIMER_MS))) {
-                bool long_pressed = control->long_pressed;
 
+            if (profile.repeat_delay_ms > 0 && (int32_t) (now - control->next_repeat) >= 0) {
+                if (emit(i, KEY_REPEAT, due)) {
+                    control->consumed = true;
+                    control->next_repeat = now + profile.repeat_rate_ms;
+                }
+            }
+        } else if (control->pressed) {
+            // key released. only send "release" if nothing else happened.
+            // A click is held back while a double click may still follow.
+            bool hold = !control->consumed && profile.double_click_ms > 0;
+            if (control->consumed || hold || emit(i, KEY_RELEASE, control->edge_time)) {
+                control->clicked = !control->consumed;
+                control->release_time = now;
                 control->pressed = false;
                 control->long_pressed = false;
-
-                // only call "on release" if not pressed long.
-                if (!long_pressed && control->on_release != nullptr) {
-                    control->on_release();
-                }
+                control->consumed = false;
             }
         }
+
+        // an event is waiting for room in the queue, or a click for the double click time
+        if (control->pressed != ((key_state & key_bit(i)) != 0) || (control->clicked && profile.double_click_ms > 0)) {
+            active = true;
+        }
     }
+
+    if (int_pin < 0) {
+        return true; // polling mode, never sleep
+    }
+
+    // leds can not ride along with the key read while the scanner sleeps
+    hardware.key_scan_active = active;
+    return active;
+}
+
+void EspyKeys::set_profile(uint8_t key, const key_profile &profile) {
+    keys[key].profile = profile;
+    debouncer.set_threshold(key_bit(key), profile.debounce_ms / KEY_TIMER_MS);
+}
+
+bool EspyKeys::emit(uint8_t key, key_event_type type, uint32_t time) {
+    key_event event = {time, key, type};
+    return events.push(event);
 }
 
 uint8_t EspyKeys::state() {
     uint8_t result = 0x00;
-    for (unsigned int i = 0; i < 3; i++) {
+    for (unsigned int i = 0; i < KEY_COUNT; i++) {
         if (keys[i].pressed) {
             result |= 1 << i;
         }
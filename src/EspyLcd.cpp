@@ -0,0 +1,184 @@
+/*
+ * Diff rendering for the LCD.
+ */
+
+#include <espy.h>
+
+// image cell that is not visible at the chosen shift
+#define LCD_DONT_CARE '\0'
+
+EspyLcd::EspyLcd(EspyLcdBus &_bus)
+        : bus(_bus) {
+    // the panel is cleared at init time
+    for (auto &i : shadow) {
+        memset(i, ' ', LCD_LINE_LENGTH);
+    }
+}
+
+void EspyLcd::invalidate() {
+    // no rendered line ever contains a NUL, so every cell will be dirty
+    for (auto &i : shadow) {
+        memset(i, '\0', LCD_LINE_LENGTH);
+    }
+    glyphs.invalidate();
+}
+
+// scroll period of a marquee text
+static uint8_t marquee_period(uint8_t length) {
+    return length > LCD_MARQUEE_SHIFT_MAX ? length + LCD_MARQUEE_GAP : LCD_LINE_LENGTH;
+}
+
+void EspyLcd::render(const lcd_frame &frame) {
+    // the display can only be shifted if every marquee text fits the display RAM
+    bool shiftable = false;
+    for (auto marquee : frame.marquee) {
+        if (marquee != nullptr) {
+            shiftable = true;
+            if (strlen(marquee) > LCD_MARQUEE_SHIFT_MAX) {
+                shiftable = false;
+                break; // for
+            }
+        }
+    }
+
+    // keep the current shift and scroll in software
+    static lcd_image image;
+    static lcd_image shifted;
+    uint8_t target = frame.step % LCD_LINE_LENGTH;
+    bool use_shift = shiftable && target == shift;
+    build(image, frame, shift, use_shift);
+
+    if (shiftable && !use_shift) {
+        // or shift the display to the marquee position
+        bool left;
+        build(shifted, frame, target, true);
+        if (diff(shifted, false) + shift_steps(target, &left) < diff(image, false)) {
+            memcpy(image, shifted, sizeof(image));
+            use_shift = true;
+        }
+    }
+
+    bus.begin_frame();
+
+    // cells showing a reloaded slot change without being rewritten
+    glyphs.upload(bus);
+    bus.flush();
+
+    diff(image, true);
+
+    if (use_shift && target != shift) {
+        bool left;
+        uint8_t steps = shift_steps(target, &left);
+        for (uint8_t i = 0; i < steps; i++) {
+            bus.command(LCD_CURSORSHIFT | LCD_DISPLAYMOVE | (left ? LCD_MOVELEFT : LCD_MOVERIGHT));
+        }
+        shift = target;
+    }
+
+    bus.end_frame();
+}
+
+// lay out the frame in display RAM as seen with the given shift
+void EspyLcd::build(lcd_image &image, const lcd_frame &frame, uint8_t at_shift, bool full_marquee) {
+    for (uint8_t row = 0; row < DISPLAY_ROWS; row++) {
+        char *line = image[row];
+        const char *marquee = frame.marquee[row];
+
+        if (marquee != nullptr && full_marquee) {
+            // the whole text sits in display RAM, the shift scrolls it
+            bool eol = false;
+            for (uint8_t i = 0; i < LCD_LINE_LENGTH; i++) {
+                if (!eol && marquee[i] == '\0') {
+                    eol = true;
+                }
+                line[i] = eol ? ' ' : marquee[i];
+            }
+            continue; // for
+        }
+
+        memset(line, LCD_DONT_CARE, LCD_LINE_LENGTH);
+
+        // the visible window. Anything after the end of the string is
+        // blank (this is what clear() used to provide)
+        uint8_t length = 0;
+        if (marquee != nullptr) {
+            length = strlen(marquee);
+        }
+
+        uint8_t period = marquee_period(length);
+        bool eol = false;
+        for (uint8_t col = 0; col < DISPLAY_COLS; col++) {
+            char c;
+            if (marquee != nullptr) {
+                uint8_t i = (frame.step + col) % period;
+                c = i < length ? marquee[i] : ' ';
+            } else {
+                c = eol ? '\0' : frame.text[row][col];
+                if (c == '\0') {
+                    eol = true;
+                    c = ' ';
+                }
+            }
+            line[(at_shift + col) % LCD_LINE_LENGTH] = c;
+        }
+    }
+}
+
+// number of cells and cursor moves needed to bring the panel to the image.
+// Sends them if send is true.
+uint16_t EspyLcd::diff(const lcd_image &image, bool send) {
+    uint16_t cost = 0;
+
+    for (uint8_t row = 0; row < DISPLAY_ROWS; row++) {
+        const char *line = image[row];
+        const char *panel = shadow[row];
+
+        uint8_t col = 0;
+        while (col < LCD_LINE_LENGTH) {
+            if (line[col] == LCD_DONT_CARE || line[col] == panel[col]) {
+                col++;
+                continue;
+            }
+
+            // start of a dirty run. Extend it over short gaps of cells
+            // whose content is known, so they can be written again.
+            uint8_t end = col + 1;
+            for (uint8_t i = end; i < LCD_LINE_LENGTH; i++) {
+                if (line[i] != LCD_DONT_CARE && line[i] != panel[i]) {
+                    end = i + 1;
+                } else if (panel[i] == '\0' || i + 1 - end > LCD_MAX_RUN_GAP) {
+                    break; // for
+                }
+            }
+
+            cost += 1 + end - col;
+            if (send) {
+                write_run(row, col, end, line);
+            }
+            col = end;
+        }
+
+        if (send) {
+            // one burst per row
+            bus.flush();
+        }
+    }
+
+    return cost;
+}
+
+// number of shift commands to get to the given shift, and their direction
+uint8_t EspyLcd::shift_steps(uint8_t to, bool *left) const {
+    uint8_t steps = (to + LCD_LINE_LENGTH - shift) % LCD_LINE_LENGTH;
+    *left = steps <= LCD_LINE_LENGTH / 2;
+    return *left ? steps : LCD_LINE_LENGTH - steps;
+}
+
+void EspyLcd::write_run(uint8_t row, uint8_t start, uint8_t end, const char *line) {
+    bus.set_cursor(start, row);
+    for (uint8_t col = start; col < end; col++) {
+        char c = line[col] != LCD_DONT_CARE ? line[col] : shadow[row][col];
+        bus.write(c);
+        shadow[row][col] = c;
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Burst mode transport for the LCD.
+ */
+
+#include <espy.h>
+
+static const uint8_t row_offsets[] = {0x00, 0x40, 0x14, 0x54};
+
+EspyLcdBus::EspyLcdBus(LiquidCrystal_I2C &_display, uint8_t _address)
+        : display(_display), address(_address) {
+    set_clock(LCD_BUS_CLOCK_HZ);
+}
+
+void EspyLcdBus::set_clock(uint32_t hz) {
+    // one byte on the bus is 9 clocks. The enable strobe of the next
+    // send follows one byte after the falling edge of the current one.
+    uint32_t byte_us = 9000000ul / hz;
+    if (byte_us == 0) {
+        byte_us = 1;
+    }
+    pad = (LCD_EXEC_TIME_US + byte_us - 1) / byte_us - 1;
+}
+
+void EspyLcdBus::set_cursor(uint8_t col, uint8_t row) {
+    command(LCD_SETDDRAMADDR | (col + row_offsets[row]));
+}
+
+void EspyLcdBus::command(uint8_t value) {
+    send(value, 0);
+}
+
+void EspyLcdBus::write(uint8_t value) {
+    send(value, Rs);
+}
+
+#ifdef _ESPY_LCD_LEGACY_BUS
+
+// every nibble is three single byte transactions in the library
+#define LCD_LEGACY_TRANSACTIONS_PER_SEND 6
+// data byte and address byte
+#define LCD_LEGACY_BYTES_PER_TRANSACTION 2
+
+void EspyLcdBus::send(uint8_t value, uint8_t rs) {
+    if (rs) {
+        display.write(value);
+    } else {
+        display.command(value);
+    }
+    frame_bytes += LCD_LEGACY_TRANSACTIONS_PER_SEND * LCD_LEGACY_BYTES_PER_TRANSACTION;
+    frame_transactions += LCD_LEGACY_TRANSACTIONS_PER_SEND;
+}
+
+void EspyLcdBus::flush() {
+}
+
+#else
+
+void EspyLcdBus::send(uint8_t value, uint8_t rs) {
+    uint8_t needed = LCD_BUS_BYTES_PER_SEND + pad + ((rs != mode) ? 1 : 0);
+    if (length + needed > LCD_BUS_BUFFER) {
+        flush();
+    }
+
+    // register select must be stable before the enable strobe rises
+    if (rs != mode) {
+        buffer[length++] = rs | backlight;
+        mode = rs;
+    }
+
+    uint8_t high = (value & 0xf0u) | rs | backlight;
+    uint8_t low = ((value << 4u) & 0xf0u) | rs | backlight;
+
+    buffer[length++] = high | En;
+    buffer[length++] = high;
+    buffer[length++] = low | En;
+    buffer[length++] = low;
+
+    for (uint8_t i = 0; i < pad; i++) {
+        buffer[length++] = low;
+    }
+}
+
+void EspyLcdBus::flush() {
+    if (length == 0) {
+        return;
+    }
+
+    i2c.submit(address, buffer, length);
+
+    frame_bytes += length + 1; // address byte
+    frame_transactions++;
+    length = 0;
+}
+
+#endif
+
+void EspyLcdBus::begin_frame() {
+    frame_start = micros();
+    frame_bytes = 0;
+    frame_transactions = 0;
+}
+
+void EspyLcdBus::end_frame() {
+    flush();
+
+    // nothing was sent, this was not a frame
+    if (frame_bytes == 0) {
+        return;
+    }
+
+    stats.frames++;
+    stats.bytes += frame_bytes;
+    stats.transactions += frame_transactions;
+    stats.last_frame_bytes = frame_bytes;
+    stats.last_frame_transactions = frame_transactions;
+    stats.last_queue_us = micros() - frame_start;
+
+    // the legacy path and a queue that drained while the frame was built
+    // have already sent everything
+    pending_start = frame_start;
+    frame_last = i2c.submitted;
+    frame_pending = true;
+    sent(i2c.sent);
+}
+
+void EspyLcdBus::sent(uint32_t count) {
+    if (!frame_pending || (int32_t) (count - frame_last) < 0) {
+        return;
+    }
+    frame_pending = false;
+
+    uint32_t elapsed = micros() - pending_start;
+    stats.last_frame_us = elapsed;
+    if (elapsed > stats.max_frame_us) {
+        stats.max_frame_us = elapsed;
+    }
+}
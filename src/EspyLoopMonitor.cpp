@@ -0,0 +1,118 @@
+//
+// Loop latency monitor
+//
+
+#include <espy.h>
+
+#define LOOP_WARNING_MAGIC 0x4c4f4f50u
+
+// gaps that no marked activity accounts for (web callbacks, wifi stack)
+static const char loop_other[] = "other";
+
+void EspyLoopMonitor::begin() {
+    static loop_warning previous;
+
+    uint32_t reason = ESP.getResetInfoPtr()->reason;
+    if ((reason == REASON_WDT_RST || reason == REASON_SOFT_WDT_RST)
+        && ESP.rtcUserMemoryRead(LOOP_MONITOR_RTC_BLOCK, (uint32_t *) &previous, sizeof(previous))
+        && previous.magic == LOOP_WARNING_MAGIC) {
+        previous.activity[LOOP_ACTIVITY_LENGTH - 1] = '\0';
+        watchdog = &previous;
+    }
+
+    // a later watchdog must not be blamed on an old warning
+    ESP.rtcUserMemoryWrite(LOOP_MONITOR_RTC_BLOCK, (uint32_t *) &warning, sizeof(warning));
+
+    last_tick_ms = millis();
+    timer.attach_ms(LOOP_WATCH_MS, watch);
+}
+
+void EspyLoopMonitor::tick() {
+    uint32_t now = micros();
+    uint32_t gap = now - last_tick_us;
+    bool first = last_tick_us == 0;
+    last_tick_us = now;
+    last_tick_ms = millis();
+
+    const char *culprit = slowest != nullptr ? slowest : loop_other;
+    slowest = nullptr;
+    slowest_us = 0;
+
+    if (first) {
+        return;
+    }
+
+    uint8_t bucket = 31 - __builtin_clz(gap | 1u);
+    if (bucket >= LOOP_HISTOGRAM_BUCKETS) {
+        bucket = LOOP_HISTOGRAM_BUCKETS - 1;
+    }
+    histogram[bucket]++;
+
+    if (gap > max_gap_us) {
+        max_gap_us = gap;
+        max_gap_activity = culprit;
+    }
+
+    if (gap > LOOP_SLOW_US) {
+        slow++;
+        last_slow_us = gap;
+        last_slow_activity = culprit;
+    }
+
+    if (warned) {
+        // the loop recovered, drop the warning record
+        warned = false;
+        warning.magic = 0;
+        ESP.rtcUserMemoryWrite(LOOP_MONITOR_RTC_BLOCK, (uint32_t *) &warning, sizeof(warning));
+    }
+}
+
+const char *EspyLoopMonitor::enter(const char *name) {
+    auto previous = (const char *) activity;
+    activity = name;
+    return previous;
+}
+
+void EspyLoopMonitor::leave(const char *previous, const char *name, uint32_t elapsed_us) {
+    activity = previous;
+    if (elapsed_us > slowest_us) {
+        slowest_us = elapsed_us;
+        slowest = name;
+    }
+}
+
+// timer callback, the loop has not ticked for a while
+void EspyLoopMonitor::watch() {
+    EspyLoopMonitor &m = loop_monitor;
+
+    uint32_t stalled = millis() - m.last_tick_ms;
+    if (stalled < LOOP_WARN_MS) {
+        return;
+    }
+
+    auto current = (const char *) m.activity;
+    if (current == nullptr) {
+        current = loop_other;
+    }
+
+    // keep the record up to date until the loop comes back or the watchdog fires
+    m.warning.magic = LOOP_WARNING_MAGIC;
+    m.warning.stalled_ms = stalled;
+    strncpy(m.warning.activity, current, LOOP_ACTIVITY_LENGTH - 1);
+    m.warning.activity[LOOP_ACTIVITY_LENGTH - 1] = '\0';
+    ESP.rtcUserMemoryWrite(LOOP_MONITOR_RTC_BLOCK, (uint32_t *) &m.warning, sizeof(m.warning));
+
+    if (!m.warned) {
+        m.warned = true;
+        m.warnings++;
+        Serial.printf("Loop stalled for %lu ms in %s\n", (unsigned long) stalled, current);
+    }
+}
+
+EspyActivity::EspyActivity(const char *_name)
+        : name(_name), previous(loop_monitor.enter(_name)), start(micros()) {
+}
+
+EspyActivity::~EspyActivity() {
+    loop_monitor.leave(previous, name, micros() - start);
+}
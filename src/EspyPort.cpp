@@ -0,0 +1,61 @@
+/*
+ * Cached PCF8574 access.
+ */
+
+#include <espy.h>
+
+EspyPort::EspyPort(uint8_t _address)
+        : address(_address) {
+}
+
+void EspyPort::begin() {
+    staged = 0xffu;
+    written = 0x00u; // force the write
+    flush();
+}
+
+void EspyPort::output(uint8_t value) {
+    if (value == written) {
+        skipped_writes++;
+    }
+    staged = value;
+}
+
+uint8_t EspyPort::input() const {
+    return last_input;
+}
+
+void EspyPort::sync() {
+    // a pending output goes out in front of the read, joined by a repeated start
+    if (dirty()) {
+        write(false);
+    }
+    transactions++;
+
+    if (i2c.request(address, 1) == 1) {
+        last_input = Wire.read();
+    }
+}
+
+void EspyPort::flush() {
+    if (dirty()) {
+        transactions++;
+        write(true);
+    }
+}
+
+bool EspyPort::dirty() const {
+    return staged != written;
+}
+
+// returns true if the port acknowledged the new value
+bool EspyPort::write(bool stop) {
+    Wire.beginTransmission(address);
+    Wire.write(staged);
+    if (i2c.end_transmission(address, stop) == I2C_OK) {
+        written = staged;
+        return true;
+    }
+    // keep the value staged, it will be retried at the next sync
+    return false;
+}
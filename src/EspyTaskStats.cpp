@@ -0,0 +1,53 @@
+//
+// Scheduler task statistics
+//
+
+#include <espy.h>
+
+EspyTaskStats *EspyTaskStats::first = nullptr;
+
+EspyTaskStats::EspyTaskStats(const char *_name)
+        : name(_name) {
+    // append, so the list is in creation order
+    EspyTaskStats **last = &first;
+    while (*last != nullptr) {
+        last = &(*last)->next;
+    }
+    *last = this;
+}
+
+uint32_t EspyTaskStats::average_us() const {
+    return calls > 0 ? (uint32_t) (total_us / calls) : 0;
+}
+
+void EspyTaskStats::reset() {
+    calls = 0;
+    total_us = 0;
+    max_us = 0;
+    last_jitter_ms = 0;
+    max_jitter_ms = 0;
+    overruns = 0;
+}
+
+EspyTaskTimer::EspyTaskTimer(EspyTaskStats &_stats, Task &task)
+        : stats(_stats), previous(loop_monitor.enter(_stats.name)), start(micros()) {
+    long delay = task.getStartDelay();
+    stats.last_jitter_ms = delay > 0 ? delay : 0;
+    if (stats.last_jitter_ms > stats.max_jitter_ms) {
+        stats.max_jitter_ms = stats.last_jitter_ms;
+    }
+    if (task.getOverrun() < 0) {
+        stats.overruns++;
+    }
+}
+
+EspyTaskTimer::~EspyTaskTimer() {
+    uint32_t elapsed = micros() - start;
+    loop_monitor.leave(previous, stats.name, elapsed);
+
+    stats.calls++;
+    stats.total_us += elapsed;
+    if (elapsed > stats.max_us) {
+        stats.max_us = elapsed;
+    }
+}
@@ -0,0 +1,75 @@
+//
+// Streaming HTML templates
+//
+
+#include <espy.h>
+
+EspyTemplate::EspyTemplate(PGM_P const *parts, uint8_t count)
+        : _parts(parts), _count(count) {
+}
+
+size_t EspyTemplate::fill(uint8_t *data, size_t len) {
+    size_t n = 0;
+    while (n < len) {
+        // finish a value first
+        if (_value != nullptr) {
+            char c = *_value;
+            if (c != '\0') {
+                data[n++] = c;
+                _value++;
+                continue; // while
+            }
+            _value = nullptr;
+        }
+
+        if (_text == nullptr && !next()) {
+            break; // while
+        }
+
+        char c = pgm_read_byte(_text);
+        if (c == '\0') {
+            _text = nullptr;
+            _item++;
+            continue; // while
+        }
+
+        // {x}, anything else (CSS, script) is copied
+        if (c == '{') {
+            char key = pgm_read_byte(_text + 1);
+            if (key != '\0' && pgm_read_byte(_text + 2) == '}') {
+                PGM_P part = (PGM_P) pgm_read_ptr(&_parts[_part]);
+                const char *v = value(part, _item, key);
+                if (v != nullptr) {
+                    _value = v;
+                    _text += 3;
+                    continue; // while
+                }
+            }
+        }
+
+        data[n++] = c;
+        _text++;
+    }
+    return n;
+}
+
+bool EspyTemplate::next() {
+    while (_part < _count) {
+        PGM_P part = (PGM_P) pgm_read_ptr(&_parts[_part]);
+        if (_item < repeat(part)) {
+            _text = text(part, _item);
+            return true;
+        }
+        _part++;
+        _item = 0;
+    }
+    return false;
+}
+
+void EspyTemplate::send(AsyncWebServerRequest *request, const std::shared_ptr<EspyTemplate> &page,
+                        const char *content_type) {
+    // the response owns the page until the last chunk is out
+    request->send(request->beginChunkedResponse(content_type, [page](uint8_t *data, size_t len, size_t index) {
+        return page->fill(data, len);
+    }));
+}
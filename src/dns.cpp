@@ -1,6 +1,8 @@
 /* -*- mode: C++; -*-
  *
- * DNS driven out of the task scheduler
+ * DNS driven out of the task scheduler. The task runs on the network
+ * layer and answers one request per iteration, so the ui layer is
+ * evaluated between two requests of a burst.
  */
 
 #include <DNSServer.h>
@@ -16,8 +18,10 @@ void dns_task();
 
 Task dnsTask(10, TASK_FOREVER, &dns_task);
 
-void dns_setup(Scheduler &scheduler) {
-    scheduler.addTask(dnsTask);
+EspyTaskStats dns_stats("dns");
+
+void dns_setup(Scheduler &network) {
+    network.addTask(dnsTask);
 }
 
 void dns_enable() {
@@ -32,5 +36,7 @@ void dns_disable() {
 }
 
 void dns_task() {
+    EspyTaskTimer timer(dns_stats, dnsTask);
+
     dns.processNextRequest();
 }
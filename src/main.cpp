@@ -14,19 +14,42 @@
 
 #include <espy.h>
 
+EspyArena boot_arena;
+EspyBootCache boot_cache;
+EspyI2c i2c;
+EspyLoopMonitor loop_monitor;
 EspyHardware *hardware;
 EspyDisplay *display;
 EspyKeys *keys;
 
+// network tasks (dns, wifi)
 Scheduler scheduler;
 
+#ifdef _TASK_PRIORITY
+// keys, display and menu. The whole layer is evaluated before every
+// task of the network layer.
+Scheduler ui_scheduler;
+#else
+Scheduler &ui_scheduler = scheduler;
+#endif
+
 // scheduler tasks
 Task displayTask(20, TASK_FOREVER, &display_task);
 Task keyboardTask(KEY_TIMER_MS, TASK_FOREVER, &keyboard_task);
 Task menuTask(100, TASK_FOREVER, &menu_task);
+Task i2cTask(TASK_IMMEDIATE, TASK_FOREVER, &i2c_task);
+
+EspyTaskStats display_stats("display");
+EspyTaskStats keyboard_stats("keyboard");
+EspyTaskStats menu_stats("menu");
+EspyTaskStats i2c_stats("i2c");
 
 EspyDisplayBuffer buf("main");
 
+void display_wakeup();
+
+void i2c_wakeup();
+
 /*
  * Run all the setup code before the main loop hits.
  */
@@ -37,28 +60,44 @@ void setup() {
     Serial.println("Setup starting");
 #endif
 
+    // watch for blocking calls from here on
+    loop_monitor.begin();
+
     // bring up display and led hardware
-    hardware = new EspyHardware();
-    display = new EspyDisplay(*hardware);
-    keys = new EspyKeys(*hardware);
+    hardware = boot_arena.make<EspyHardware>();
+    display = boot_arena.make<EspyDisplay>(*hardware, display_wakeup);
+    keys = boot_arena.make<EspyKeys>(*hardware);
 
     // point display at the current buf
     display->display(&buf);
 
     // bring up the scheduler
     scheduler.init();
+#ifdef _TASK_PRIORITY
+    ui_scheduler.init();
+    scheduler.setHighPriorityScheduler(&ui_scheduler);
+#endif
+
+    // send the queued display writes in the background
+    ui_scheduler.addTask(i2cTask);
+    i2c.queue_wakeup = i2c_wakeup;
+    i2cTask.enable();
 
     // start the background display refresh task
-    scheduler.addTask(displayTask);
+    ui_scheduler.addTask(displayTask);
     displayTask.enable();
 
-    scheduler.addTask(keyboardTask);
+    ui_scheduler.addTask(keyboardTask);
     keyboardTask.enable();
 
-    scheduler.addTask(menuTask);
+    ui_scheduler.addTask(menuTask);
 
     // bring up the system tasks
 
+    // the network layer only runs the ui layer if it holds a task,
+    // so it gets one even if the hardware check fails
+    dns_setup(scheduler);
+
     // Enable all other tasks only if the hardware is ok.
     if (self_check(&buf)) {
         // enable other tasks here
@@ -66,36 +105,98 @@ void setup() {
         menu_setup();
         menuTask.enable();
 
-        dns_setup(scheduler);
         wifi_setup(scheduler);
 
         // LED 0 is heartbeat when the menu is shown.
-        menu_buffer.leds[0] = led_state::SLOW;
+        menu_buffer.set_led(0, led_state::SLOW);
         display->display(&menu_buffer);
     }
 }
 
 boolean self_check(EspyDisplayBuffer *sc_buf) {
     if (hardware->error == HW_NO_DISPLAY_FOUND) {
-        sc_buf->leds[0] = led_state::FAST;
+        sc_buf->set_led(0, led_state::FAST);
         Serial.println("No LCD found!");
     } else if (hardware->error == HW_NO_PCF_FOUND) {
-        sc_buf->lcd_print_P(0, PSTR("NO PCF CHIP FOUND!"));
+        sc_buf->lcd_row(0, F("NO PCF CHIP FOUND!"));
+        sc_buf->commit();
         Serial.println("No PCF Chip found!");
     }
 
+    Serial.printf("I2C %lu Hz, %lu recoveries\n", (unsigned long) i2c.clock, (unsigned long) i2c.recoveries);
+    for (auto &d : i2c.devices) {
+        if (d.address != 0xff) {
+            Serial.printf("I2C 0x%02x: %lu nack, %lu timeout, %lu mismatch\n",
+                          d.address, (unsigned long) d.nacks, (unsigned long) d.timeouts,
+                          (unsigned long) d.mismatches);
+        }
+    }
+
+    Serial.printf("Boot arena %u of %u bytes, %u on the heap\n", (unsigned) boot_arena.used(),
+                  (unsigned) EspyArena::capacity(), (unsigned) boot_arena.overflow());
+
+    if (loop_monitor.watchdog != nullptr) {
+        Serial.printf("Watchdog reset, loop stalled for %lu ms in %s\n",
+                      (unsigned long) loop_monitor.watchdog->stalled_ms, loop_monitor.watchdog->activity);
+    }
+
     return hardware->error == HW_NO_ERROR; // true if all is fine
 }
 
 
 void display_task() {
-    display->refresh();
+    EspyTaskTimer timer(display_stats, displayTask);
+
+    // sleep until the next blink edge or render request
+    uint32_t next = display->refresh();
+    if (next > 0) {
+        displayTask.delay(next);
+    } else {
+        displayTask.forceNextIteration();
+    }
+}
+
+// called when the displayed buffer changed
+void display_wakeup() {
+    displayTask.forceNextIteration();
+}
+
+void i2c_task() {
+    EspyTaskTimer timer(i2c_stats, i2cTask);
+
+    if (!i2c.run(I2C_TICK_BUDGET_US)) {
+        // queue empty, sleep until the next submit
+        i2cTask.disable();
+    }
+}
+
+// called when a transaction was queued
+void i2c_wakeup() {
+    i2cTask.enableIfNot();
 }
 
 void keyboard_task() {
-    keys->scan();
+    EspyTaskTimer timer(keyboard_stats, keyboardTask);
+
+    // the latency clock starts when the scan was due, not when it ran
+    bool active = keys->scan(keyboard_stats.last_jitter_ms);
+
+    // act on key events right away instead of at the next menu tick
+    if (keys->events.size() > 0) {
+        menuTask.forceNextIteration();
+    }
+
+    if (!active) {
+        // all keys released, sleep until the INT line fires
+        keyboardTask.disable();
+    }
 }
 
 void loop() {
+    loop_monitor.tick();
+
+    if (EspyKeys::wakeup()) {
+        keyboardTask.enableIfNot();
+    }
     scheduler.execute();
 }
@@ -8,6 +8,11 @@
 
 EspyDisplayBuffer menu_buffer("menu");
 
+// time from the raw key edge (or the time a long press, repeat or held back
+// click was due) to its menu action. Includes the debounce time.
+uint32_t key_latency_ms = 0;
+uint32_t key_latency_max_ms = 0;
+
 // housekeeping functions
 void lcdml_menu_display();
 
@@ -18,6 +23,8 @@ void lcdml_menu_back(uint8_t);
 
 void lcdml_screensaver(uint8_t);
 
+void lcdml_tasks(uint8_t);
+
 bool always_false() {
     return false;
 }
@@ -39,23 +46,32 @@ LCDML_addAdvanced (7, LCDML_0_1_1, 6, NULL, "Hostname", settings, 5, _LCDML_TYPE
 LCDML_add         (8, LCDML_0_1_1, 7, "< Back", lcdml_menu_back);
 LCDML_add         (9, LCDML_0_1, 2, "System", nullptr);
 LCDML_addAdvanced (10, LCDML_0_1_2, 1, NULL, "LEDs", settings, 100, _LCDML_TYPE_default); // 100 == position 0 (see settings method)
-LCDML_add         (11, LCDML_0_1_2, 2, "< Back", lcdml_menu_back);
-LCDML_add         (12, LCDML_0_1, 3, "MQTT", nullptr);
-LCDML_add         (13, LCDML_0_1_3, 1, "< Back", lcdml_menu_back);
-LCDML_add         (14, LCDML_0_1, 4, "< Back", lcdml_menu_back);
-LCDML_add         (15, LCDML_0, 2, "Settings", nullptr);
-LCDML_add         (16, LCDML_0_2, 1, "Configure Wifi", wifi_setup_activate);
-LCDML_add         (17, LCDML_0_2, 2, "Reset Wifi", wifi_reset);
-LCDML_add         (18, LCDML_0_2, 3, "< Back", lcdml_menu_back);
-LCDML_addAdvanced (19, LCDML_0, 3, always_false, "screensaver", lcdml_screensaver, 0, _LCDML_TYPE_default);
+LCDML_addAdvanced (11, LCDML_0_1_2, 2, NULL, "LCD Bus", settings, 101, _LCDML_TYPE_default);
+LCDML_addAdvanced (12, LCDML_0_1_2, 3, NULL, "I2C Bus", settings, 102, _LCDML_TYPE_default);
+LCDML_addAdvanced (13, LCDML_0_1_2, 4, NULL, "Key Latency", settings, 103, _LCDML_TYPE_default);
+LCDML_add         (14, LCDML_0_1_2, 5, "Tasks", lcdml_tasks);
+LCDML_addAdvanced (15, LCDML_0_1_2, 6, NULL, "Loop", settings, 105, _LCDML_TYPE_default);
+LCDML_addAdvanced (16, LCDML_0_1_2, 7, NULL, "Memory", settings, 106, _LCDML_TYPE_default);
+LCDML_add         (17, LCDML_0_1_2, 8, "< Back", lcdml_menu_back);
+LCDML_add         (18, LCDML_0_1, 3, "MQTT", nullptr);
+LCDML_addAdvanced (19, LCDML_0_1_3, 1, NULL, "MQTT Server", settings, 200, _LCDML_TYPE_default);
+LCDML_add         (20, LCDML_0_1_3, 2, "< Back", lcdml_menu_back);
+LCDML_add         (21, LCDML_0_1, 4, "< Back", lcdml_menu_back);
+LCDML_add         (22, LCDML_0, 2, "Settings", nullptr);
+LCDML_add         (23, LCDML_0_2, 1, "Configure Wifi", wifi_setup_activate);
+LCDML_add         (24, LCDML_0_2, 2, "Reset Wifi", wifi_reset);
+LCDML_add         (25, LCDML_0_2, 3, "< Back", lcdml_menu_back);
+LCDML_addAdvanced (26, LCDML_0, 3, always_false, "screensaver", lcdml_screensaver, 0, _LCDML_TYPE_default);
 
 // menu element count - last element id
 // this value must be the same as the last menu element
-#define _LCDML_DISP_cnt 19
+#define _LCDML_DISP_cnt 26
 
 // create menu
 LCDML_createMenu(_LCDML_DISP_cnt);
 
+typedef void (*key_func)(void);
+
 void func_enter() {
     LCDML.BT_enter();
 }
@@ -72,57 +88,115 @@ void func_quit() {
     LCDML.BT_quit();
 }
 
-void func_left() {
-    LCDML.BT_left();
+// menu action for key release (short press), autorepeat, long press and double click, per key.
+// Up and down repeat instead of a long press, so the keys have no left / right.
+const key_func key_release_funcs[] = {func_up, func_down, func_enter};
+const key_func key_repeat_funcs[] = {func_up, func_down, nullptr};
+const key_func key_long_press_funcs[] = {nullptr, nullptr, func_quit};
+const key_func key_double_click_funcs[] = {nullptr, nullptr, func_quit};
+
+// signal strength bars for the current connection
+char signal_glyph() {
+    if (WiFi.status() != WL_CONNECTED) {
+        return display->glyph(GLYPH_SIGNAL_0);
+    }
+
+    int quality = CustomWiFiManager::getRSSIasQuality(WiFi.RSSI());
+    if (quality >= 70) {
+        return display->glyph(GLYPH_SIGNAL_3);
+    } else if (quality >= 40) {
+        return display->glyph(GLYPH_SIGNAL_2);
+    } else if (quality > 0) {
+        return display->glyph(GLYPH_SIGNAL_1);
+    }
+    return display->glyph(GLYPH_SIGNAL_0);
 }
 
-void func_right() {
-    LCDML.BT_right();
+char led_glyph(int n) {
+    return display->glyph(GLYPH_LED_OFF + (int) menu_buffer.leds[n]);
 }
 
 void settings(uint8_t param) {
     // offset for param (0...) after % must match child order to find the right text
     if (LCDML.FUNC_setup()) {
         // resolve some of the menu macro magic to end up with this line
-        uint8_t menu_pos = param % 100; // 0-99 = wifi, 100-199 = system.
+        uint8_t menu_pos = param % 100; // 0-99 = wifi, 100-199 = system, 200-299 = mqtt.
         LCDMenuLib2_menu *current_menu = LCDML.MENU_getCurrentObj()->getChild(menu_pos);
-        menu_buffer.lcd_print(0, g_LCDML_DISP_lang_lcdml_table[current_menu->getID()]);
+        menu_buffer.lcd_row(0, g_LCDML_DISP_lang_lcdml_table[current_menu->getID()]);
 
         switch (param) {
 
             // WIFI Settings
             case 0:
-                menu_buffer.lcd_print(1, WiFi.SSID().c_str());
+                menu_buffer.lcd_row(0, align_left(g_LCDML_DISP_lang_lcdml_table[current_menu->getID()], DISPLAY_COLS - 1),
+                                    signal_glyph());
+                menu_buffer.lcd_marquee(1, WiFi.SSID().c_str());
                 break;
             case 1:
                 if (wifiManager != nullptr) {
-                    menu_buffer.lcd_print_P(1, PSTR("Retry: %d"), wifiManager->connectionRetries);
+                    menu_buffer.lcd_row(1, F("Retry: "), wifiManager->connectionRetries,
+                                        F(" Nets: "), wifiManager->credentialCount());
                 } else {
-                    menu_buffer.lcd_print_P(1, PSTR("Retry unknown"));
+                    menu_buffer.lcd_row(1, F("Retry unknown"));
                 }
                 break;
             case 2:
-                menu_buffer.lcd_print(1, WiFi.localIP().toString().c_str());
+                menu_buffer.lcd_row(1, WiFi.localIP());
                 break;
             case 3:
-                menu_buffer.lcd_print(1, WiFi.gatewayIP().toString().c_str());
+                menu_buffer.lcd_row(1, WiFi.gatewayIP());
                 break;
             case 4:
-                menu_buffer.lcd_print(1, WiFi.dnsIP().toString().c_str());
+                menu_buffer.lcd_row(1, WiFi.dnsIP());
                 break;
             case 5:
-                menu_buffer.lcd_print(1, WiFi.hostname().c_str());
+                menu_buffer.lcd_marquee(1, WiFi.hostname().c_str());
                 break;
 
                 // System Settings
             case 100:
-                menu_buffer.lcd_print_P(1, PSTR("%s %s %s %s %s"), LED_STATE(&menu_buffer, 0), LED_STATE(&menu_buffer, 1),
-                                        LED_STATE(&menu_buffer, 2), LED_STATE(&menu_buffer, 3), LED_STATE(&menu_buffer, 4));
+                menu_buffer.lcd_row(1, led_glyph(0), ' ', led_glyph(1), ' ', led_glyph(2), ' ',
+                                    led_glyph(3), ' ', led_glyph(4));
+                break;
+            case 101:
+                if (hardware->lcd_bus != nullptr) {
+                    menu_buffer.lcd_row(1, hardware->lcd_bus->stats.last_frame_bytes, F("B "),
+                                        hardware->lcd_bus->stats.last_frame_us, F("us"));
+                } else {
+                    menu_buffer.lcd_row(1, F("no display"));
+                }
+                break;
+            case 102:
+                menu_buffer.lcd_row(1, i2c.clock / 1000, F("k N"), i2c.total_nacks(),
+                                    F(" T"), i2c.total_timeouts(), F(" R"), i2c.recoveries);
+                break;
+            case 103:
+                menu_buffer.lcd_row(1, key_latency_ms, F("ms max "), key_latency_max_ms, F("ms"));
+                break;
+            case 105:
+                // longest loop gap and what ran, or what hung before a watchdog reset
+                if (loop_monitor.watchdog != nullptr) {
+                    menu_buffer.lcd_row(1, F("WDT "), loop_monitor.watchdog->activity);
+                } else if (loop_monitor.max_gap_activity != nullptr) {
+                    menu_buffer.lcd_row(1, loop_monitor.max_gap_us / 1000, F("ms "), loop_monitor.max_gap_activity);
+                } else {
+                    menu_buffer.lcd_row(1, F("no data"));
+                }
+                break;
+            case 106:
+                // boot arena high water mark and free heap
+                menu_buffer.lcd_row(1, F("A"), (unsigned) boot_arena.used(), F(" H"), ESP.getFreeHeap());
+                break;
+
+                // MQTT Settings
+            case 200:
+                menu_buffer.lcd_marquee(1, mqtt_server.getValue());
                 break;
             default:
-                menu_buffer.lcd_print_P(1, PSTR("unknown"));
+                menu_buffer.lcd_row(1, F("unknown"));
                 break;
         }
+        menu_buffer.commit();
         LCDML.FUNC_setLoopInterval(100);
     }
 
@@ -150,18 +224,46 @@ void menu_setup() {
     // Enable Screensaver (screensaver menu function, time to activate in ms)
     LCDML.SCREEN_enable(lcdml_screensaver, 30000ul);
 
-    keys->keys[0].on_release = func_up;
-    keys->keys[0].on_long_press = func_left;
-    keys->keys[1].on_release = func_down;
-    keys->keys[1].on_long_press = func_right;
-    keys->keys[2].on_release = func_enter;
-    keys->keys[2].on_long_press = func_quit;
+    // up and down scroll while held instead of a long press
+    key_profile scroll = {DEBOUNCE_TIME_MS, 0, KEY_REPEAT_DELAY_MS, KEY_REPEAT_RATE_MS, 0};
+    keys->set_profile(0, scroll);
+    keys->set_profile(1, scroll);
+
+    // double click on enter goes back without holding the key
+    key_profile enter = {DEBOUNCE_TIME_MS, LONG_PRESS_TIME_MS, 0, 0, DOUBLE_CLICK_TIME_MS};
+    keys->set_profile(2, enter);
 }
 
 //
 // called by the scheduler to drive the menu code
 //
 void menu_task() {
+    EspyTaskTimer timer(menu_stats, menuTask);
+
+    // drain all key events that arrived since the last run
+    key_event event{};
+    while (keys->events.pop(event)) {
+        key_func func = nullptr;
+        if (event.type == KEY_RELEASE) {
+            func = key_release_funcs[event.key];
+        } else if (event.type == KEY_REPEAT) {
+            func = key_repeat_funcs[event.key];
+        } else if (event.type == KEY_LONG_PRESS) {
+            func = key_long_press_funcs[event.key];
+        } else if (event.type == KEY_DOUBLE_CLICK) {
+            func = key_double_click_funcs[event.key];
+        }
+
+        // only events with an action count towards the latency
+        if (func != nullptr) {
+            key_latency_ms = millis() - event.time;
+            if (key_latency_ms > key_latency_max_ms) {
+                key_latency_max_ms = key_latency_ms;
+            }
+            func();
+        }
+    }
+
     LCDML.loop();
 }
 
@@ -170,7 +272,10 @@ void lcdml_menu_clear() {
 }
 
 void lcdml_menu_display() {
-    if (LCDML.DISP_checkMenuUpdate()) {
+    bool menu_update = LCDML.DISP_checkMenuUpdate();
+    bool cursor_update = LCDML.DISP_checkMenuCursorUpdate();
+
+    if (menu_update) {
         // clear menu
         // ***************
         LCDML.DISP_clear();
@@ -193,7 +298,7 @@ void lcdml_menu_display() {
                     // check the type off a menu element
                     if (tmp->checkType_menu() == true) {
                         // resolve some of the menu macro magic to end up with this line
-                        menu_buffer.lcd_print_P(n, " %s", g_LCDML_DISP_lang_lcdml_table[tmp->getID()]);
+                        menu_buffer.lcd_row(n, ' ', g_LCDML_DISP_lang_lcdml_table[tmp->getID()]);
                     } else {
                         if (tmp->checkType_dynParam()) {
                             tmp->callback(n);
@@ -208,7 +313,7 @@ void lcdml_menu_display() {
         }
     }
 
-    if (LCDML.DISP_checkMenuCursorUpdate()) {
+    if (cursor_update) {
         // init vars
         uint8_t n_max = (LCDML.MENU_getChilds() >= DISPLAY_ROWS) ? DISPLAY_ROWS : LCDML.MENU_getChilds();
 
@@ -219,6 +324,11 @@ void lcdml_menu_display() {
             }
         }
     }
+
+    // show menu and cursor as one frame
+    if (menu_update || cursor_update) {
+        menu_buffer.commit();
+    }
 }
 
 uint8_t sb_col = 0;
@@ -229,7 +339,7 @@ void lcdml_screensaver(uint8_t param) {
     if (LCDML.FUNC_setup()) {
         menu_buffer.clear();
         menu_buffer.text[0][0] = '.';
-        menu_buffer.request_render();
+        menu_buffer.commit();
 
         LCDML.FUNC_setLoopInterval(100);
     }
@@ -247,17 +357,48 @@ void lcdml_screensaver(uint8_t param) {
             sb_col++;
             if (sb_col == DISPLAY_COLS) sb_col = 0;
             menu_buffer.text[sb_row][sb_col] = '.';
-            menu_buffer.request_render();
+            menu_buffer.commit();
         }
     }
 
     if (LCDML.FUNC_close()) {
-        // The screensaver goes to the root menu
+        // The screensaver goes to the root menu, which redraws the buffer
         menu_buffer.clear();
         LCDML.MENU_goRoot();
     }
 }
 
+EspyTaskStats *shown_task = nullptr;
+
+// task statistics, up and down select the task
+void lcdml_tasks(uint8_t param) {
+    if (LCDML.FUNC_setup()) {
+        shown_task = EspyTaskStats::first;
+        LCDML.FUNC_setLoopInterval(500);
+    }
+
+    if (LCDML.FUNC_loop()) {
+        if (LCDML.BT_checkDown()) {
+            shown_task = shown_task->next != nullptr ? shown_task->next : EspyTaskStats::first;
+        } else if (LCDML.BT_checkUp()) {
+            EspyTaskStats *prev = EspyTaskStats::first;
+            while (prev->next != nullptr && prev->next != shown_task) {
+                prev = prev->next;
+            }
+            shown_task = prev;
+        } else if (LCDML.BT_checkAny()) {
+            LCDML.FUNC_goBackToMenu();
+            return;
+        }
+        LCDML.BT_resetAll();
+
+        // name and calls, then average / max run time, max jitter and overruns
+        menu_buffer.lcd_row(0, align_left(shown_task->name, 9), align_right(shown_task->calls, 7));
+        menu_buffer.lcd_row(1, shown_task->average_us(), '/', shown_task->max_us, F("u J"),
+                            shown_task->max_jitter_ms, F(" O"), shown_task->overruns);
+        menu_buffer.commit();
+    }
+}
 
 void lcdml_menu_back(uint8_t param) {
     if (LCDML.FUNC_setup()) {
@@ -1,6 +1,8 @@
 /* -*- mode: C++; -*-
  *
- * Wifi Code
+ * Wifi Code. Scan and connect run on the network layer. Each iteration
+ * does one step (start or poll a scan, one connect state) and never waits
+ * for the radio, so the ui layer is evaluated between them.
  */
 
 #include <ESP8266WiFi.h>
@@ -15,61 +17,144 @@ CustomWiFiManager *wifiManager = nullptr;
 
 CustomWiFiManagerParameter mqtt_server("server", "mqtt server", "mqtt.intermeta.com", 40);
 
+void wifi_scan_task();
+
+void wifi_connect_task();
+
+// runs only while a scan is requested or running
+Task wifiScanTask(250, TASK_FOREVER, &wifi_scan_task);
+Task wifiConnectTask(WIFI_MANAGER_CONNECTION_TASK_TIME_MS, TASK_FOREVER, &wifi_connect_task);
+
+EspyTaskStats wifi_scan_stats("wifiscan");
+EspyTaskStats wifi_connect_stats("wificonn");
+
+// LED 0 is on while a scan runs
 void wifi_scan_task() {
-    wifi_buf.leds[0] = led_state::ON;
-    display->refresh(); // needs a refresh as the scan is blocking
+    EspyTaskTimer timer(wifi_scan_stats, wifiScanTask);
 
-    if (wifiManager != nullptr) {
-        wifiManager->scanNetworkTask();
+    if (wifiManager == nullptr || !wifiManager->scanNetworkTask()) {
+        wifiScanTask.disable();
+    } else if (wifiManager->scanRunning()) {
+        wifi_buf.set_led(0, led_state::ON);
     }
+}
 
-    wifi_buf.leds[0] = led_state::OFF;
-    display->refresh(); // needs a refresh as the scan is blocking
+// a page asked for a scan
+void wifi_scan_request() {
+    wifiScanTask.enableIfNot();
+}
+
+void wifi_scan_done(int found) {
+    wifi_buf.set_led(0, led_state::OFF);
 }
 
 //
 // LED 2 flashes while connecting, LED 3 turns on when connected
 //
 void wifi_connect_task() {
+    EspyTaskTimer timer(wifi_connect_stats, wifiConnectTask);
+
     if (wifiManager != nullptr) {
-        wifiManager->connectTask();
+        // sleep until the next timeout or backoff expires, wifi events wake up earlier.
+        // delay(0) would mean the task interval, not right away.
+        uint32_t next = wifiManager->connectTask();
+        if (next > 0) {
+            wifiConnectTask.delay(next);
+        } else {
+            wifiConnectTask.forceNextIteration();
+        }
 
-        if (WiFi.status() == WL_CONNECTED) {
-            menu_buffer.leds[2] = led_state::OFF;
-            menu_buffer.leds[3] = led_state::ON;
+        if (wifiManager->connectState() == WIFI_STATE_CONNECTED) {
+            menu_buffer.set_led(2, led_state::OFF);
+            menu_buffer.set_led(3, led_state::ON);
         } else {
-            menu_buffer.leds[3] = led_state::OFF;
-            LED_TOGGLE(&menu_buffer, 2);
+            menu_buffer.set_led(3, led_state::OFF);
+            menu_buffer.set_led(2, led_state::SLOW);
         }
     }
 }
 
-Task wifiScanTask(10000, TASK_FOREVER, &wifi_scan_task);
-Task wifiConnectTask(WIFI_MANAGER_CONNECTION_TASK_TIME_MS, TASK_FOREVER, &wifi_connect_task);
+// called from the station event handlers
+void wifi_connect_event() {
+    wifiConnectTask.forceNextIteration();
+}
 
-void wifi_setup(Scheduler &scheduler) {
-    scheduler.addTask(wifiScanTask);
-    scheduler.addTask(wifiConnectTask);
+void wifi_setup(Scheduler &network) {
+    network.addTask(wifiScanTask);
+    network.addTask(wifiConnectTask);
 
-    wifiManager = new CustomWiFiManager(&server);
+    wifiManager = boot_arena.make<CustomWiFiManager>(&server);
     wifiManager->addParameter(&mqtt_server);
+    wifiManager->setScanCompleteCallback(wifi_scan_done);
+    wifiManager->setScanRequestCallback(wifi_scan_request);
+    wifiManager->setConnectEventCallback(wifi_connect_event);
 
     wifiConnectTask.enable();
 }
 
+// scheduler task statistics, one task per line
+void wifi_tasks_page(AsyncWebServerRequest *request) {
+    EspyActivity activity("http /tasks");
+
+    String page = F("task calls avg_us max_us jitter_ms max_jitter_ms overruns\n");
+    char line[96];
+    for (EspyTaskStats *task = EspyTaskStats::first; task != nullptr; task = task->next) {
+        snprintf_P(line, sizeof(line), PSTR("%s %lu %lu %lu %lu %lu %lu\n"), task->name,
+                   (unsigned long) task->calls, (unsigned long) task->average_us(), (unsigned long) task->max_us,
+                   (unsigned long) task->last_jitter_ms, (unsigned long) task->max_jitter_ms,
+                   (unsigned long) task->overruns);
+        page += line;
+    }
+    snprintf_P(line, sizeof(line), PSTR("key_latency_ms %lu max %lu\n"),
+               (unsigned long) key_latency_ms, (unsigned long) key_latency_max_ms);
+    page += line;
+
+    snprintf_P(line, sizeof(line), PSTR("arena_bytes %u of %u arena_overflow %u\nfree_heap %u max_block %u\n"),
+               (unsigned) boot_arena.used(), (unsigned) EspyArena::capacity(), (unsigned) boot_arena.overflow(),
+               (unsigned) ESP.getFreeHeap(), (unsigned) ESP.getMaxFreeBlockSize());
+    page += line;
+
+    // loop gaps, bucket n counts gaps of 2^n to 2^(n+1)-1 us
+    page += F("loop_histogram");
+    for (auto count : loop_monitor.histogram) {
+        page += ' ';
+        page += count;
+    }
+    snprintf_P(line, sizeof(line), PSTR("\nloop_max_us %lu %s\nloop_slow %lu last %lu %s\nloop_warnings %lu\n"),
+               (unsigned long) loop_monitor.max_gap_us, loop_monitor.max_gap_activity ? loop_monitor.max_gap_activity : "-",
+               (unsigned long) loop_monitor.slow, (unsigned long) loop_monitor.last_slow_us,
+               loop_monitor.last_slow_activity ? loop_monitor.last_slow_activity : "-",
+               (unsigned long) loop_monitor.warnings);
+    page += line;
+    if (loop_monitor.watchdog != nullptr) {
+        snprintf_P(line, sizeof(line), PSTR("watchdog_reset %lu %s\n"),
+                   (unsigned long) loop_monitor.watchdog->stalled_ms, loop_monitor.watchdog->activity);
+        page += line;
+    }
+    request->send(200, "text/plain", page);
+}
+
 void wifi_config_mode() {
-    wifiManager->resetSettings();
+    // keeps the saved networks, a save in the portal adds to them
+    wifiManager->disconnect();
 
     server.reset();
     wifiManager->enableConfigPortal("NuclearDevice");
+    server.on("/tasks", wifi_tasks_page);
     dns_enable();
 
+    // scans are started by the /wifi page
     wifiConnectTask.disable();
-    wifiScanTask.enable();
 }
 
 void wifi_connect_mode() {
+    // nothing polls a scan once its task is off
+    if (wifiManager->scanPending()) {
+        wifiManager->cancelScan();
+        wifi_buf.set_led(0, led_state::OFF);
+    }
     wifiScanTask.disable();
+    wifiManager->disableConfigPortal();
     wifiConnectTask.enable();
 
     server.reset();
@@ -79,14 +164,15 @@ void wifi_connect_mode() {
 void wifi_setup_activate(uint8_t param) {
     if (LCDML.FUNC_setup()) {
         display->display(&wifi_buf);
-        wifi_buf.leds[4] = led_state::ON;
+        wifi_buf.set_led(4, led_state::ON);
 
         LCDML.FUNC_setLoopInterval(WIFI_MANAGER_CONFIG_MENU_TASK_TIME_MS);
 
         wifi_config_mode();
 
-        wifi_buf.lcd_print_P(0, PSTR("%s"), WiFi.softAPSSID().c_str());
-        wifi_buf.lcd_print_P(1, PSTR("%s"), WiFi.softAPIP().toString().c_str());
+        wifi_buf.lcd_row(0, WiFi.softAPSSID());
+        wifi_buf.lcd_row(1, WiFi.softAPIP());
+        wifi_buf.commit();
     }
 
     if (LCDML.FUNC_loop()) {
@@ -110,14 +196,20 @@ void wifi_setup_activate(uint8_t param) {
     }
 }
 
+// seconds until the reset, any key cancels
+#define WIFI_RESET_SECONDS 6
+
 int countdown, it;
 
 void wifi_reset(uint8_t param) {
+    const int ticks = 1000 / WIFI_MANAGER_CONFIG_MENU_TASK_TIME_MS;
+
     if (LCDML.FUNC_setup()) {
-        countdown = 6;
-        it = 1000 / WIFI_MANAGER_CONFIG_MENU_TASK_TIME_MS;
+        countdown = WIFI_RESET_SECONDS;
+        it = ticks;
         display->display(&wifi_buf);
-        wifi_buf.lcd_print_P(0, PSTR("WIFI RESET!"));
+        wifi_buf.lcd_row(0, F("WIFI RESET!"));
+        wifi_buf.commit();
 
         LCDML.FUNC_setLoopInterval(WIFI_MANAGER_CONFIG_MENU_TASK_TIME_MS);
     }
@@ -128,15 +220,21 @@ void wifi_reset(uint8_t param) {
         }
 
         if (--it == 0) {
-            it = 1000 / WIFI_MANAGER_CONFIG_MENU_TASK_TIME_MS;
-            if (--countdown < 0) {
-                wifi_buf.lcd_print_P(1, PSTR("Resetting"));
-                wifiManager->resetSettings();
-                LCDML.FUNC_goBackToMenu();
-            } else {
-                wifi_buf.lcd_print_P(1, PSTR("%d..."), countdown);
-            }
+            it = ticks;
+            countdown--;
+        }
+
+        if (countdown < 0) {
+            wifi_buf.lcd_row(1, F("Resetting"));
+            wifiManager->resetSettings();
+            LCDML.FUNC_goBackToMenu();
+        } else {
+            // seconds left and a bar running down with every tick
+            char bar[DISPLAY_COLS - 1];
+            display->bar(bar, DISPLAY_COLS - 2, countdown * ticks + it, (WIFI_RESET_SECONDS + 1) * ticks);
+            wifi_buf.lcd_row(1, countdown, ' ', (const char *) bar);
         }
+        wifi_buf.commit();
     }
 
     if (LCDML.FUNC_close()) {